@@ -0,0 +1,899 @@
+/* Batch engine for protocols 5 and 6.
+ *
+ * Parameter studies run the same protocol on thousands of links.  This
+ * engine holds all of them at once in structure-of-arrays form: for every
+ * variable of a worker (window edges, nbuffered, timers, counters) there is
+ * an array with one element per link, or lane.  All lanes share the clock,
+ * so one step of the engine is one pass of main's loop for every lane.
+ *
+ * A step is done in two parts.  The work every lane does on every step --
+ * main picking M0 or M1, the deadlock check, looking at the queue, timer
+ * and ack timer expiry, choosing the event -- is a sequence of kernels, each
+ * a loop over the lanes without branches: every lane computes the result and
+ * keeps it only if its mask says it applies (it was picked, it is still
+ * running, ...).  These loops compile to vector code; run_block() is built
+ * for AVX-512, AVX2 and plain x86-64, and the best version the CPU supports
+ * is picked when the program starts.  The protocol's own work differs from
+ * lane to lane and most lanes have none on a given step, so instead of
+ * masking it the lanes are sorted by event into lists and each list is run
+ * through the code for that one event.  Lanes are processed in blocks that
+ * fit in the cache, and each block runs from the first tick to the last
+ * before the next one starts.
+ *
+ * Protocols 5 and 6 are not run from p5.c and p6.c but restated here,
+ * together with the parts of worker.c they use.  The restatement is exact:
+ * a lane draws from the same random number streams as link l of the
+ * in-process engine and produces the same statistics, so "sim -b -l N" and
+ * "sim -l N" print the same results.  Each lane's ring of frames in transit
+ * to a worker starts with QSIZE slots and doubles when it fills, as queue[]
+ * does in worker.c; a lane with MAX_QUEUE frames in transit stops with "Out
+ * of queue space", as the other engines do.  Debug tracing is not supported.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "common.h"
+
+#define MAX_SEQ 7		/* same as in p5.c and p6.c */
+#define NR_BUFS ((MAX_SEQ + 1)/2)	/* protocol 6 */
+#define NT (MAX_SEQ + 1)	/* timers per worker */
+#define AUX 2			/* as in worker.c */
+#define RTO_MIN (2 * DELTA)	/* as in worker.c */
+#define RTO_MAX (64 * timeout_interval)
+#define NO_TIMER (~(bigint) 0)	/* what recalc_timers() in worker.c gives */
+#define QSIZE 64		/* initial ring of one worker (2^n); it doubles */
+#define MAX_QUEUE 100000	/* as in worker.c */
+#define NALLOC 80		/* arrays setup() allocates (69), and room to spare */
+#define BLOCK 256		/* lanes per block */
+
+/* A frame in transit is packed into one word: payload in the low 32 bits,
+ * then seq, ack and kind a byte each.
+ */
+#define PACK(k, s, a, p) (((bigint)(k)<<48) | ((bigint)(s)<<40) | ((bigint)(a)<<32) | (bigint)(p))
+#define KIND(f) ((unsigned int) ((f) >> 48) & 0377)
+#define SEQ(f) ((unsigned int) ((f) >> 40) & 0377)
+#define ACK(f) ((unsigned int) ((f) >> 32) & 0377)
+#define PKT(f) ((unsigned int) (f))
+
+/* Events, per lane and step.  IDLE lanes are not taking a turn. */
+#define IDLE	0
+#define NONE	1
+#define FRAME	2
+#define NET	3
+#define TIMEOUT	4
+#define ACKTO	5
+#define NEV	6
+
+/* Why a lane stopped. */
+#define END_RUN      0		/* reached the last tick */
+#define END_DIED     1		/* picked a worker that had exited */
+#define END_DEADLOCK 2
+#define END_QUEUE    3
+#define END_PRECISE  4		/* precise enough (-p) */
+
+/* The same generator as next_random() in worker.c. */
+#define LCG(x) ((x) * 6364136223846793005UL + 1442695040888963407UL)
+#define DRAW(x) ((unsigned int) ((x) >> 33) & 01777)
+
+/* between() of p5.c and p6.c. */
+#define between(a, b, c) \
+	((((a) <= (b)) && ((b) < (c))) || (((c) < (a)) && ((a) <= (b))) || \
+	 (((b) < (c)) && ((c) < (a))))
+
+/* Statistics, by position in collect_statistics(). */
+#define DATA_SENT 0
+#define DATA_LOST 1
+#define DATA_NOT_LOST 2
+#define DATA_RETRANS 3
+#define GOOD_ACKS 4
+#define BAD_ACKS 5
+#define GOOD_DATA 6
+#define BAD_DATA 7
+#define PAYLOADS 8
+#define ACKS_SENT 9
+#define ACKS_LOST 10
+#define ACKS_NOT_LOST 11
+#define TIMEOUTS 12
+#define ACK_TIMEOUTS 13
+#define NAKS_SENT 14
+
+struct side {			/* M0 (or M1) of every lane */
+  /* Used by the kernels, one element per lane.  They are all 64 bits wide,
+   * since the compiler does not vectorize loops that mix widths.
+   */
+  bigint *rng;			/* random number stream */
+  bigint *lowest;		/* lowest_timer in worker.c */
+  bigint *aux;			/* auxiliary timer (protocol 6) */
+  bigint *head, *vis, *tail;	/* ring: next out, end of queue[], end */
+  bigint *net;			/* network layer enabled? */
+  bigint *word;			/* last reply to main */
+  bigint *dead;			/* worker has exited */
+
+  /* Used only by the protocol, one element or row per lane. */
+  bigint **ring;		/* per lane: frames sent to this side */
+  bigint *room;			/* per lane: slots in ring[] (2^n) */
+  bigint (*timer)[NT];		/* frame timers, 0 if not running */
+  bigint (*sent_at)[NT];	/* when the timed frame was sent; 0 if resent */
+  long *srtt, *rttvar;		/* as in worker.c, times 8 and 4 */
+  bigint *rto;			/* adaptive timeout interval, before backoff */
+  unsigned int *repeats;	/* timeouts since the last ack */
+  unsigned int (*seqs)[NT];	/* seqs[] of worker.c */
+  unsigned int (*buf)[MAX_SEQ+1];	/* outbound buffers (6 uses NR_BUFS) */
+  unsigned int (*in)[NR_BUFS];	/* inbound buffers (protocol 6) */
+  unsigned int *next_pkt;	/* next_net_pkt */
+  unsigned int *last_pkt;	/* last_pkt_given */
+  unsigned int *nfs, *ae, *fe, *too_far, *nbuf;	/* window edges, nbuffered */
+  unsigned int *no_nak, *arrived, *oldest;	/* protocol 6 */
+  bigint (*st)[NSTAT];		/* statistics, as in collect_statistics() */
+};
+
+static int n;			/* lanes, rounded up to a multiple of 16 */
+static void *alloc[NALLOC];	/* what lanes() allocated, for release() */
+static int nalloc;
+static struct side side[2];
+static bigint *mrng;		/* main's random number stream */
+static bigint *endtime;		/* tick at which the lane stopped */
+static bigint *live;		/* lane still running? */
+static bigint *why;		/* END_RUN etc. */
+static bigint *proc;		/* worker picked in this step */
+static bigint *ev;		/* event of the picked worker */
+static struct means *means;	/* batch means of each lane (-p) */
+static int job;			/* first link, which is the job number */
+static bigint done[2][NSTAT];	/* statistics of the blocks finished (-m) */
+static bigint done_events;	/* and the events they took */
+static int done_lanes;
+static int list[NEV][BLOCK];	/* lanes of this block, by event */
+static int count[NEV];		/* how many lanes are on each list */
+
+/* The worker taking its turn, as in worker.c. */
+static struct side *s, *p;	/* its side and its peer's */
+static int me;			/* 0 or 1 */
+static int lane;		/* its lane */
+static bigint tick;
+static unsigned int offset;	/* prevents two timeouts at the same tick */
+static unsigned int retransmitting;	/* counts retransmissions */
+static unsigned int touched;	/* a timer was started or stopped */
+
+/* Prototypes. */
+static void *lanes(int size);
+static void setup(int first, int step, int nl);
+static void release(void);
+static void grow_ring(void);
+static void run_block(int lo, int hi, bigint last_tick);
+static int converge(int lo, int hi, bigint t);
+static void share(int lo, int hi, bigint t);
+static void collect(int first, int step, int nl, struct result *res);
+
+
+void run_batch(int first, int step, bigint last_tick, struct result *res)
+{
+/* Simulate links first, first + step, first + 2*step, etc. as lanes of one
+ * batch and store their results in res[].
+ */
+
+  int nl, lo, hi;
+
+  nl = (links - first + step - 1) / step;	/* lanes in this batch */
+  job = first;
+  setup(first, step, nl);
+  for (lo = 0; lo < nl; lo += BLOCK) {
+	hi = (lo + BLOCK < nl ? lo + BLOCK : nl);
+	run_block(lo, hi, last_tick);
+  }
+  collect(first, step, nl, res);
+  release();
+}
+
+
+static void *lanes(int size)
+{
+/* Allocate a zeroed array with one element of the given size per lane. */
+
+  void *q;
+
+  if (posix_memalign(&q, 64, n * size) != 0) {
+	printf("Out of memory for %d lanes\n", n);
+	exit(1);
+  }
+  memset(q, 0, n * size);
+  alloc[nalloc++] = q;
+  return(q);
+}
+
+
+static void setup(int first, int step, int nl)
+{
+/* Allocate the arrays and put every lane in the state the protocols are
+ * in when they first call wait_for_event().
+ */
+
+  int e, i;
+  struct side *sp;
+
+  n = (nl + 15) & ~15;
+  for (e = 0; e < 2; e++) {
+	sp = &side[e];
+	sp->rng = lanes(sizeof(bigint));
+	sp->lowest = lanes(sizeof(bigint));
+	sp->aux = lanes(sizeof(bigint));
+	sp->head = lanes(sizeof(bigint));
+	sp->vis = lanes(sizeof(bigint));
+	sp->tail = lanes(sizeof(bigint));
+	sp->net = lanes(sizeof(bigint));
+	sp->word = lanes(sizeof(bigint));
+	sp->dead = lanes(sizeof(bigint));
+	sp->ring = lanes(sizeof(bigint *));
+	sp->room = lanes(sizeof(bigint));
+	sp->timer = lanes(sizeof(sp->timer[0]));
+	sp->sent_at = lanes(sizeof(sp->sent_at[0]));
+	sp->srtt = lanes(sizeof(long));
+	sp->rttvar = lanes(sizeof(long));
+	sp->rto = lanes(sizeof(bigint));
+	sp->repeats = lanes(sizeof(int));
+	sp->seqs = lanes(sizeof(sp->seqs[0]));
+	sp->buf = lanes(sizeof(sp->buf[0]));
+	sp->in = lanes(sizeof(sp->in[0]));
+	sp->next_pkt = lanes(sizeof(int));
+	sp->last_pkt = lanes(sizeof(int));
+	sp->nfs = lanes(sizeof(int));
+	sp->ae = lanes(sizeof(int));
+	sp->fe = lanes(sizeof(int));
+	sp->too_far = lanes(sizeof(int));
+	sp->nbuf = lanes(sizeof(int));
+	sp->no_nak = lanes(sizeof(int));
+	sp->arrived = lanes(sizeof(int));
+	sp->oldest = lanes(sizeof(int));
+	sp->st = lanes(sizeof(sp->st[0]));
+
+	for (i = 0; i < nl; i++) {
+		sp->rng[i] = stream_seed(first + i * step, e);
+		sp->net[i] = 1;		/* enable_network_layer() */
+		sp->last_pkt[i] = 0xFFFFFFFF;
+		sp->too_far[i] = NR_BUFS;
+		sp->no_nak[i] = 1;
+		sp->oldest[i] = MAX_SEQ + 1;
+		sp->word[i] = OK;
+		sp->rto[i] = timeout_interval;
+		sp->room[i] = QSIZE;
+		sp->ring[i] = malloc(QSIZE * sizeof(bigint));
+		if (sp->ring[i] == NULL) {
+			printf("Out of memory for %d lanes\n", n);
+			exit(1);
+		}
+	}
+  }
+  mrng = lanes(sizeof(bigint));
+  endtime = lanes(sizeof(bigint));
+  live = lanes(sizeof(bigint));
+  why = lanes(sizeof(bigint));
+  proc = lanes(sizeof(bigint));
+  ev = lanes(sizeof(bigint));
+  means = lanes(sizeof(struct means));
+  for (i = 0; i < nl; i++) {
+	mrng[i] = stream_seed(first + i * step, 2);
+	live[i] = 1;
+  }
+}
+
+
+static void release(void)
+{
+/* Free what setup() allocated, so that the next batch starts afresh. */
+
+  int e, i;
+
+  for (e = 0; e < 2; e++)
+	for (i = 0; i < n; i++) free(side[e].ring[i]);
+  while (nalloc > 0) free(alloc[--nalloc]);
+}
+
+
+/* Kernels: loops over all the lanes of a block, without branches. */
+
+static inline void pick(int lo, int hi)
+{
+/* Main picks M0 or M1 for every lane. */
+
+  int i;
+
+#pragma GCC ivdep
+  for (i = lo; i < hi; i++) {
+	mrng[i] = LCG(mrng[i]);
+	proc[i] = (mrng[i] >> 33) & 1;
+  }
+}
+
+
+static inline void choose(int e, int lo, int hi, bigint t)
+{
+/* Main's bookkeeping for the lanes that picked side e: stop lanes whose
+ * worker has exited or that are deadlocked, as main() does.  With both
+ * sides QUIET, no frame in either ring means none is on the way.
+ */
+
+  int i;
+  bigint m, d, dl;
+  bigint *word = side[e].word, *other = side[1-e].word;
+  bigint *head = side[e].head, *tail = side[e].tail;
+  bigint *ohead = side[1-e].head, *otail = side[1-e].tail;
+  bigint *dead = side[e].dead;
+
+#pragma GCC ivdep
+  for (i = lo; i < hi; i++) {
+	m = live[i] & (proc[i] == e);
+	d = m & dead[i];
+	dl = (word[i] == QUIET) & (other[i] == QUIET);
+	dl &= (head[i] == tail[i]) & (ohead[i] == otail[i]);
+	dl = dl ? m & !d : 0;
+	why[i] = dl ? END_DEADLOCK : why[i];
+	why[i] = d ? END_DIED : why[i];
+	endtime[i] = (d | dl) ? t : endtime[i];
+	live[i] &= !(d | dl);
+	ev[i] = (m & !(d | dl)) ? NONE : IDLE;
+  }
+}
+
+
+static inline void classify(int e, int lo, int hi, bigint t)
+{
+/* Pick_event() for every lane taking a turn, and its reply to main.  A
+ * timer of 0 is not running, so "timer - 1 < t" means it has gone off.
+ */
+
+  int i;
+  bigint x, w, lt, ax, ta = (protocol == 6 ? t : 0);
+  bigint *lowest = side[e].lowest, *aux = side[e].aux;
+  bigint *head = side[e].head, *vis = side[e].vis;
+  bigint *net = side[e].net, *word = side[e].word;
+
+#pragma GCC ivdep
+  for (i = lo; i < hi; i++) {
+	lt = lowest[i];
+	ax = aux[i];
+	x = (lt - 1 < t) ? TIMEOUT : NONE;
+	x = net[i] ? NET : x;
+	x = (head[i] != vis[i]) ? FRAME : x;
+	x = (ax - 1 < ta) ? ACKTO : x;
+	x = (ev[i] != IDLE) ? x : IDLE;
+	aux[i] = (x == ACKTO) ? 0 : ax;		/* check_ack_timer() */
+	w = ((lt == 0) | (lt == NO_TIMER)) & (ax == 0) ? QUIET : OK;
+	w = (x == NONE) ? w : OK;
+	word[i] = (x != IDLE) ? w : word[i];
+	ev[i] = x;
+  }
+}
+
+
+static inline void sort(int lo, int hi)
+{
+/* Put the lanes on the list for their event. */
+
+  int i, k;
+
+  for (k = 0; k < NEV; k++) count[k] = 0;
+  for (i = lo; i < hi; i++) list[ev[i]][count[ev[i]]++] = i;
+}
+
+
+static inline void arrive(int e, int lo, int hi, bigint t)
+{
+/* The end of a turn: queue_frames() makes the frames the peer sent so far
+ * visible.  A lane with MAX_QUEUE frames in transit to either worker is
+ * stopped.
+ */
+
+  int i;
+  bigint full, stop;
+  struct side *sp = &side[e], *o = &side[1-e];
+
+#pragma GCC ivdep
+  for (i = lo; i < hi; i++) {
+	sp->vis[i] = (ev[i] != IDLE) ? sp->tail[i] : sp->vis[i];
+	full = ((o->tail[i] - o->head[i] >= MAX_QUEUE) & !o->dead[i]) |
+	       ((sp->tail[i] - sp->head[i] >= MAX_QUEUE) & !sp->dead[i]);
+	stop = live[i] & full;
+	why[i] = stop ? END_QUEUE : why[i];
+	endtime[i] = stop ? t : endtime[i];
+	live[i] &= !full;
+  }
+}
+
+
+/* The parts of worker.c the protocols use, for the worker taking its turn. */
+
+static void transmit(bigint f)
+{
+  bigint *st = s->st[lane];
+  unsigned int k = KIND(f);
+
+  if (protocol == 6 && k == data) s->seqs[lane][SEQ(f) % NR_BUFS] = SEQ(f);
+  if (k == data) st[DATA_SENT]++;
+  if (k == ack) st[ACKS_SENT]++;
+  if (k == nak) st[NAKS_SENT]++;
+  if (retransmitting) st[DATA_RETRANS]++;
+
+  s->rng[lane] = LCG(s->rng[lane]);
+  if (DRAW(s->rng[lane]) < (unsigned int) pkt_loss) {
+	if (k == data) st[DATA_LOST]++;
+	if (k == ack) st[ACKS_LOST]++;
+	return;
+  }
+  if (k == data) st[DATA_NOT_LOST]++;
+  if (k == ack) st[ACKS_NOT_LOST]++;
+  if (p->tail[lane] - p->head[lane] == p->room[lane]) grow_ring();
+  p->ring[lane][p->tail[lane]++ & (p->room[lane] - 1)] = f;
+}
+
+
+static void grow_ring(void)
+{
+/* The peer's ring is full: double it, keeping each frame at the slot its
+ * position selects in the larger ring.
+ */
+
+  bigint k, old = p->room[lane], *q;
+
+  q = malloc(2 * old * sizeof(bigint));
+  if (q == NULL) {
+	printf("Out of memory for the ring of lane %d\n", lane);
+	exit(1);
+  }
+  for (k = p->head[lane]; k != p->tail[lane]; k++)
+	q[k & (2 * old - 1)] = p->ring[lane][k & (old - 1)];
+  free(p->ring[lane]);
+  p->ring[lane] = q;
+  p->room[lane] = 2 * old;
+}
+
+
+static bigint take_frame(int *good)
+{
+/* Frametype(): take the frame at the head of the queue and decide whether
+ * it arrived intact.
+ */
+
+  bigint *st = s->st[lane];
+  bigint f;
+
+  f = s->ring[lane][s->head[lane]++ & (s->room[lane] - 1)];
+  s->rng[lane] = LCG(s->rng[lane]);
+  *good = (DRAW(s->rng[lane]) >= (unsigned int) garbled);
+  if (KIND(f) == data) st[*good ? GOOD_DATA : BAD_DATA]++;
+  if (KIND(f) == ack) st[*good ? GOOD_ACKS : BAD_ACKS]++;
+  return(f);
+}
+
+
+static int deliver(unsigned int pkt)
+{
+/* Returns 0 if the packet is out of order; the worker has then exited. */
+
+  if (pkt != s->last_pkt[lane] + 1) {
+	printf("Tick %lu. Proc %d got protocol error.  Packet delivered out of order.\n", tick/DELTA, me);
+	printf("Expected payload %u but got payload %u\n", s->last_pkt[lane] + 1, pkt);
+	s->dead[lane] = 1;
+	return(0);
+  }
+  s->last_pkt[lane] = pkt;
+  s->st[lane][PAYLOADS]++;
+  return(1);
+}
+
+
+static void rtt_sample(bigint m)
+{
+  long delta;
+
+  if (s->srtt[lane] == 0) {
+	s->srtt[lane] = m << 3;
+	s->rttvar[lane] = m << 1;
+  } else {
+	delta = (long) m - (s->srtt[lane] >> 3);
+	s->srtt[lane] += delta;
+	if (delta < 0) delta = -delta;
+	s->rttvar[lane] += delta - (s->rttvar[lane] >> 2);
+  }
+  s->rto[lane] = (s->srtt[lane] >> 3) + s->rttvar[lane];
+  if (s->rto[lane] < RTO_MIN) s->rto[lane] = RTO_MIN;
+  if (s->rto[lane] > RTO_MAX) s->rto[lane] = RTO_MAX;
+}
+
+
+static bigint timeout_in_use(struct side *sp, int i)
+{
+/* As in worker.c: rto, doubled for each repeated timeout. */
+
+  bigint t;
+  unsigned int n;
+
+  if (!adaptive) return(timeout_interval);
+  t = sp->rto[i];
+  for (n = 1; n < sp->repeats[i] && t < RTO_MAX; n++) t = 2 * t;
+  return(t < RTO_MAX ? t : RTO_MAX);
+}
+
+
+static void set_timer(unsigned int k)
+{
+  int i;
+
+  if (retransmitting || s->timer[lane][k] != 0) {
+	for (i = 0; i < NT; i++) s->sent_at[lane][i] = 0;
+  } else {
+	s->sent_at[lane][k] = tick;
+  }
+  s->timer[lane][k] = tick + timeout_in_use(s, lane) + offset;
+  offset++;
+  touched = 1;
+}
+
+
+static void clear_timer(unsigned int k)
+{
+  if (s->timer[lane][k] != 0 && s->sent_at[lane][k] != 0)
+	rtt_sample(tick - s->sent_at[lane][k]);
+  s->sent_at[lane][k] = 0;
+  s->repeats[lane] = 0;
+  s->timer[lane][k] = 0;
+  touched = 1;
+}
+
+
+static void set_ack_timer(void)
+{
+  s->aux[lane] = tick + timeout_interval/AUX;
+  offset++;
+}
+
+
+static void expire_timer(void)
+{
+/* The lowest timer went off: turn it off and count it. */
+
+  int k;
+
+  for (k = 0; k < NT; k++) {
+	if (s->timer[lane][k] == s->lowest[lane]) {
+		s->timer[lane][k] = 0;
+		s->oldest[lane] = s->seqs[lane][k];
+		touched = 1;
+		break;
+	}
+  }
+  s->st[lane][TIMEOUTS]++;
+  retransmitting = 1;
+  s->repeats[lane]++;
+}
+
+
+static void begin(int e, int i, bigint t)
+{
+/* Worker e of lane i is about to handle an event. */
+
+  s = &side[e];
+  p = &side[1-e];
+  me = e;
+  lane = i;
+  tick = t;
+  offset = 0;
+  retransmitting = 0;
+  touched = 0;
+}
+
+
+static void end(unsigned int window)
+{
+/* The end of the protocol's loop body: enable or disable the network layer
+ * and, if a timer was started or stopped, find the lowest one.
+ */
+
+  int k;
+  bigint t, *tm = s->timer[lane];
+
+  s->net[lane] = (s->nbuf[lane] < window);
+  if (touched) {
+	t = NO_TIMER;
+	for (k = 0; k < NT; k++)
+		if (tm[k] > 0 && tm[k] < t) t = tm[k];
+	s->lowest[lane] = t;
+  }
+}
+
+
+/* Protocol 5, one function per event. */
+
+static void send_data5(unsigned int frame_nr, unsigned int frame_expected)
+{
+  transmit(PACK(data, frame_nr, (frame_expected + MAX_SEQ) & MAX_SEQ,
+			 s->buf[lane][frame_nr]));
+  set_timer(frame_nr);
+}
+
+
+static void frame5(void)
+{
+  int good;
+  unsigned int *ae = &s->ae[lane], *fe = &s->fe[lane];
+  bigint r;
+
+  r = take_frame(&good);
+  if (!good) return;		/* cksum_err: just ignore bad frames */
+  if (SEQ(r) == *fe) {
+	if (!deliver(PKT(r))) return;
+	inc(*fe);
+  }
+  while (between(*ae, ACK(r), s->nfs[lane])) {
+	s->nbuf[lane]--;
+	clear_timer(*ae);
+	inc(*ae);
+  }
+}
+
+
+static void net5(void)
+{
+  unsigned int *nfs = &s->nfs[lane];
+
+  s->buf[lane][*nfs] = s->next_pkt[lane]++;
+  s->nbuf[lane]++;
+  send_data5(*nfs, s->fe[lane]);
+  inc(*nfs);
+}
+
+
+static void timeout5(void)
+{
+  unsigned int i, *nfs = &s->nfs[lane];
+
+  expire_timer();
+  *nfs = s->ae[lane];
+  for (i = 1; i <= s->nbuf[lane]; i++) {
+	send_data5(*nfs, s->fe[lane]);
+	inc(*nfs);
+  }
+}
+
+
+/* Protocol 6, one function per event. */
+
+static void send_frame6(unsigned int fk, unsigned int frame_nr, unsigned int frame_expected)
+{
+  unsigned int info = (fk == data ? s->buf[lane][frame_nr % NR_BUFS] : 0);
+
+  if (fk == nak) s->no_nak[lane] = 0;
+  transmit(PACK(fk, frame_nr, (frame_expected + MAX_SEQ) & MAX_SEQ,
+									info));
+  if (fk == data) set_timer(frame_nr % NR_BUFS);
+  s->aux[lane] = 0;		/* stop_ack_timer() */
+}
+
+
+static void frame6(void)
+{
+  int good;
+  unsigned int *ae = &s->ae[lane], *fe = &s->fe[lane];
+  unsigned int *arrived = &s->arrived[lane], seq, nr;
+  bigint r;
+
+  r = take_frame(&good);
+  if (!good) {			/* cksum_err */
+	if (s->no_nak[lane]) send_frame6(nak, 0, *fe);
+	return;
+  }
+  seq = SEQ(r);
+  if (KIND(r) == data) {
+	if (seq != *fe && s->no_nak[lane])
+		send_frame6(nak, 0, *fe);
+	else
+		set_ack_timer();
+	if (between(*fe, seq, s->too_far[lane]) &&
+	    !(*arrived & (1 << (seq % NR_BUFS)))) {
+		*arrived |= 1 << (seq % NR_BUFS);
+		s->in[lane][seq % NR_BUFS] = PKT(r);
+		while (*arrived & (1 << (*fe % NR_BUFS))) {
+			if (!deliver(s->in[lane][*fe % NR_BUFS]))
+				return;
+			s->no_nak[lane] = 1;
+			*arrived &= ~(1 << (*fe % NR_BUFS));
+			inc(*fe);
+			inc(s->too_far[lane]);
+			set_ack_timer();
+		}
+	}
+  }
+  nr = (ACK(r) + 1) & MAX_SEQ;
+  if (KIND(r) == nak && between(*ae, nr, s->nfs[lane]))
+	send_frame6(data, nr, *fe);
+  while (between(*ae, ACK(r), s->nfs[lane])) {
+	s->nbuf[lane]--;
+	clear_timer(*ae % NR_BUFS);
+	inc(*ae);
+  }
+}
+
+
+static void net6(void)
+{
+  unsigned int *nfs = &s->nfs[lane];
+
+  s->nbuf[lane]++;
+  s->buf[lane][*nfs % NR_BUFS] = s->next_pkt[lane]++;
+  send_frame6(data, *nfs, s->fe[lane]);
+  inc(*nfs);
+}
+
+
+static void timeout6(void)
+{
+  expire_timer();
+  send_frame6(data, s->oldest[lane], s->fe[lane]);
+}
+
+
+static void ack_timeout6(void)
+{
+  s->st[lane][ACK_TIMEOUTS]++;
+  send_frame6(ack, 0, s->fe[lane]);
+}
+
+
+static inline void turn(int e, bigint t)
+{
+/* Run the protocol for the lanes on the event lists.  A lane whose worker
+ * exits (protocol error) skips end(), as the worker never gets there.
+ */
+
+  int j, *l;
+
+  if (protocol == 5) {
+	for (j = 0, l = list[FRAME]; j < count[FRAME]; j++) {
+		begin(e, l[j], t);
+		frame5();
+		if (!s->dead[lane]) end(MAX_SEQ);
+	}
+	for (j = 0, l = list[NET]; j < count[NET]; j++) {
+		begin(e, l[j], t);
+		net5();
+		end(MAX_SEQ);
+	}
+	for (j = 0, l = list[TIMEOUT]; j < count[TIMEOUT]; j++) {
+		begin(e, l[j], t);
+		timeout5();
+		end(MAX_SEQ);
+	}
+  } else {
+	for (j = 0, l = list[FRAME]; j < count[FRAME]; j++) {
+		begin(e, l[j], t);
+		frame6();
+		if (!s->dead[lane]) end(NR_BUFS);
+	}
+	for (j = 0, l = list[NET]; j < count[NET]; j++) {
+		begin(e, l[j], t);
+		net6();
+		end(NR_BUFS);
+	}
+	for (j = 0, l = list[TIMEOUT]; j < count[TIMEOUT]; j++) {
+		begin(e, l[j], t);
+		timeout6();
+		end(NR_BUFS);
+	}
+	for (j = 0, l = list[ACKTO]; j < count[ACKTO]; j++) {
+		begin(e, l[j], t);
+		ack_timeout6();
+		end(NR_BUFS);
+	}
+  }
+}
+
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void run_block(int lo, int hi, bigint last_tick)
+{
+/* Run lanes lo to hi - 1 from the first tick to the last. */
+
+  int e, i;
+  bigint t, batch;
+
+  batch = (precision > 0 ? batch_ticks() : 0);
+  for (t = first_tick + DELTA; t <= last_tick; t += DELTA) {
+	pick(lo, hi);
+	for (e = 0; e < 2; e++) {
+		choose(e, lo, hi, t);
+		classify(e, lo, hi, t);
+		sort(lo, hi);
+		turn(e, t);
+		arrive(e, lo, hi, t);
+	}
+	if (batch > 0 && t % batch == 0 && converge(lo, hi, t) == 0) break;
+	if (metrics_at != NULL && t % (PUBLISH * DELTA) == 0) share(lo, hi, t);
+  }
+  for (i = lo; i < hi; i++)
+	if (live[i]) endtime[i] = last_tick;
+  if (metrics_at != NULL) {	/* the block is done */
+	share(lo, hi, last_tick);
+	for (i = lo; i < hi; i++) {
+		for (e = 0; e < 2 * NSTAT; e++)
+			done[e/NSTAT][e%NSTAT] += side[e/NSTAT].st[i][e%NSTAT];
+		done_events += endtime[i]/DELTA;
+	}
+	done_lanes += hi - lo;
+  }
+}
+
+
+static void share(int lo, int hi, bigint t)
+{
+/* Publish the statistics of the lanes so far (-m): those of the blocks
+ * finished plus those of lanes lo to hi - 1.  The timeout in use and the
+ * round trip time are only worked out at the end, so they are left out.
+ */
+
+  int i, e, k;
+  bigint st[2][NSTAT], events = done_events;
+
+  memcpy(st, done, sizeof(st));
+  for (i = lo; i < hi; i++) {
+	events += (live[i] ? t : endtime[i])/DELTA;
+	for (e = 0; e < 2; e++)
+		for (k = 0; k < NSTAT; k++) st[e][k] += side[e].st[i][k];
+  }
+  publish(job, events, done_lanes + hi - lo, done_lanes, st);
+}
+
+
+static int converge(int lo, int hi, bigint t)
+{
+/* A batch has ended (-p): stop the lanes that are precise enough, as
+ * run_link() in engine.c does, and return how many are still running.
+ */
+
+  int i, e, left = 0;
+  bigint c[3];
+
+  for (i = lo; i < hi; i++) {
+	if (!live[i]) continue;
+	c[PRG_PAYLOADS] = c[PRG_SENT] = c[PRG_RETRANS] = 0;
+	for (e = 0; e < 2; e++) {
+		c[PRG_PAYLOADS] += side[e].st[i][PAYLOADS];
+		c[PRG_SENT] += side[e].st[i][DATA_SENT];
+		c[PRG_RETRANS] += side[e].st[i][DATA_RETRANS];
+	}
+	if (add_batch(&means[i], c)) {
+		live[i] = 0;
+		why[i] = END_PRECISE;
+		endtime[i] = t;
+	} else {
+		left++;
+	}
+  }
+  return(left);
+}
+
+
+static void collect(int first, int step, int nl, struct result *res)
+{
+/* Copy each lane's statistics into the result for its link. */
+
+  static char *reason[] = {"End of simulation", "",
+			   "A deadlock has been detected", "Out of queue space",
+			   "Precision reached"};
+  int i, e, k;
+  struct result *r;
+
+  for (i = 0; i < nl; i++) {
+	r = &res[first + i * step];
+	r->link = first + i * step;
+	r->time = endtime[i];
+	strcpy(r->reason, reason[why[i]]);
+	end_means(&means[i], r);
+	for (e = 0; e < 2; e++) {
+		r->alive[e] = !side[e].dead[i];
+		for (k = 0; k < NSTAT; k++) r->stats[e][k] = side[e].st[i][k];
+		r->stats[e][ST_RTO] = timeout_in_use(&side[e], i)/DELTA;
+		r->stats[e][ST_SRTT] = (side[e].srtt[i] >> 3)/DELTA;
+	}
+  }
+}
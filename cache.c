@@ -0,0 +1,171 @@
+/* Cache of the results of runs (-c).
+ *
+ * Sweeps often repeat runs that were done before.  With -c dir, the output
+ * of a run is kept in dir, in a file named after a hash of everything that
+ * determines it: the parameters and options, as parse_args() understood
+ * them, and the contents of the sim binary itself, so a rebuilt simulator
+ * never finds the results of an old one.  When the same run is asked for
+ * again, the output is copied from the file instead of being simulated.
+ *
+ * Only runs that can be repeated are cached: the in-process and batch
+ * engines, and the fork engine with -d.  Runs that do more than print (-m,
+ * -o) or read a trace file, which might have changed, are not.
+ *
+ * On a miss the simulation runs in a child process whose output, and that
+ * of every process it forks, goes down a pipe; the parent copies it to the
+ * real output and to the file as it comes.  When the cache grows beyond
+ * CACHE_MAX bytes, the files used longest ago are removed.  sim -c dir -r
+ * empties the cache.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <utime.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "common.h"
+
+#define CACHE_MAX (64L << 20)	/* bytes the cache may take up */
+#define HASH_LEN 16		/* hex digits in a file name */
+
+/* Prototypes. */
+static bigint hash(bigint h, char *p, long n);
+static int entry(char *name);
+static void trim(char *dir);
+
+
+void use_cache(char *key)
+{
+/* Print the stored output of the run described by key and exit, or
+ * return in a child that simulates it while its output is stored.
+ */
+
+  int fd[2], out, n, status;
+  long size;
+  bigint h;
+  char path[1024], tmp[1060], buf[8192];
+  FILE *fp;
+  pid_t pid;
+
+  /* The key and the binary make the name. */
+  h = hash(0xCBF29CE484222325UL, key, strlen(key));
+  if ((out = open("/proc/self/exe", O_RDONLY)) < 0) return;
+  while ((n = read(out, buf, sizeof(buf))) > 0) h = hash(h, buf, n);
+  close(out);
+  mkdir(cache_at, 0777);
+  snprintf(path, sizeof(path), "%s/%016lx", cache_at, h);
+
+  /* A hit: the first line is the exit status, the rest the output. */
+  if ((fp = fopen(path, "r")) != NULL && fgets(buf, sizeof(buf), fp) != NULL &&
+					sscanf(buf, "%d", &status) == 1) {
+	utime(path, (struct utimbuf *) 0);	/* used now */
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		fwrite(buf, 1, n, stdout);
+	exit(status);
+  }
+  if (fp != NULL) fclose(fp);
+
+  /* A miss: run it in a child and keep what it prints. */
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+  if (pipe(fd) < 0 || (out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+	return;			/* run it without the cache */
+  if ((pid = fork()) == 0) {
+	close(fd[0]);
+	close(out);
+	dup2(fd[1], 1);
+	close(fd[1]);
+	return;
+  }
+  close(fd[1]);
+  write(out, "0\n", 2);		/* room for the status, filled in below */
+  size = 0;
+  while ((n = read(fd[0], buf, sizeof(buf))) > 0) {
+	write(1, buf, n);
+	if (size < CACHE_MAX/8) write(out, buf, n);
+	size += n;
+  }
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || size >= CACHE_MAX/8) {
+	unlink(tmp);		/* killed, or too big to keep */
+  } else {
+	buf[0] = '0' + WEXITSTATUS(status) % 10;
+	pwrite(out, buf, 1, 0L);
+	rename(tmp, path);
+  }
+  close(out);
+  trim(cache_at);
+  exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+
+void clear_cache(void)
+{
+/* Remove every entry from the cache (-r). */
+
+  DIR *d;
+  struct dirent *e;
+  char path[1024];
+
+  if ((d = opendir(cache_at)) == NULL) return;
+  while ((e = readdir(d)) != NULL) {
+	if (!entry(e->d_name)) continue;
+	snprintf(path, sizeof(path), "%s/%s", cache_at, e->d_name);
+	unlink(path);
+  }
+  closedir(d);
+}
+
+
+static bigint hash(bigint h, char *p, long n)
+{
+/* FNV-1a, 64 bits. */
+
+  while (n-- > 0) h = (h ^ (*p++ & 0377)) * 0x100000001B3UL;
+  return(h);
+}
+
+
+static int entry(char *name)
+{
+/* Is this file name one of ours? */
+
+  return(strlen(name) == HASH_LEN &&
+			strspn(name, "0123456789abcdef") == HASH_LEN);
+}
+
+
+static void trim(char *dir)
+{
+/* Remove the entries used longest ago until the cache fits in CACHE_MAX. */
+
+  DIR *d;
+  struct dirent *e;
+  struct stat sb;
+  char path[1024], oldest[1024];
+  long total;
+  time_t when;
+
+  for (;;) {
+	if ((d = opendir(dir)) == NULL) return;
+	total = 0;
+	when = 0;
+	while ((e = readdir(d)) != NULL) {
+		if (!entry(e->d_name)) continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if (stat(path, &sb) < 0) continue;
+		total += sb.st_size;
+		if (when == 0 || sb.st_mtime < when) {
+			when = sb.st_mtime;
+			strcpy(oldest, path);
+		}
+	}
+	closedir(d);
+	if (total <= CACHE_MAX || when == 0) return;
+	unlink(oldest);
+  }
+}
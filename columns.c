@@ -0,0 +1,275 @@
+/* Columnar output of frames and payloads (-o).
+ *
+ * The debug printouts are fine for following a short run by eye, but too
+ * slow and too big to analyze a long one.  With -o dir every process that
+ * runs workers writes two tables into a directory of its own under dir (M0
+ * and M1 in the fork engine, job0, job1, ... otherwise):
+ *
+ *	frames		one row for every frame sent, lost or received
+ *	payloads	one row for every packet fetched from the network
+ *			layer: when it arrived, when it was first sent, how
+ *			many times it was sent and when it was delivered
+ *
+ * Each column of a table is a file of its own, such as frames.tick, holding
+ * nothing but the values of all rows as fixed size integers in the native
+ * byte order, so it can be mapped into memory as an array as it stands
+ * (numpy.memmap, for instance).  The file schema lists the tables, their
+ * number of rows and their columns with their types.  Times are in events.
+ *
+ * Rows are collected ROWS at a time per column and written with one write()
+ * per column.  A packet's row is written when the packet is long gone: when
+ * the sender fetches the packet RING numbers later (no window is that big),
+ * or at the end.  Until then its entry in ring[] is updated by the sender
+ * and, on delivery, by the receiver; the fork engine keeps ring[] in memory
+ * shared by M0 and M1 for that.
+ */
+
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "common.h"
+
+#define ROWS 65536		/* rows buffered before they are written */
+#define RING 256		/* packets followed per worker */
+
+struct column {
+  char *name;
+  char *type;
+  int width;			/* bytes per value */
+  char *buf;			/* ROWS values */
+  int fd;
+};
+
+struct table {
+  char *name;
+  int ncols;
+  struct column *col;
+  int n;			/* rows in the buffers */
+  bigint rows;			/* rows written so far, and buffered */
+};
+
+static struct column frame_col[] = {
+  {"tick", "uint64", 8}, {"link", "uint32", 4}, {"proc", "uint8", 1},
+  {"event", "uint8", 1}, {"kind", "uint8", 1}, {"seq", "uint8", 1},
+  {"ack", "uint8", 1}, {"payload", "uint32", 4}
+};
+static struct column payload_col[] = {
+  {"link", "uint32", 4}, {"proc", "uint8", 1}, {"payload", "uint32", 4},
+  {"generated", "uint64", 8}, {"first_sent", "uint64", 8},
+  {"sends", "uint32", 4}, {"delivered", "uint64", 8}
+};
+static struct table frames = {"frames", 8, frame_col};
+static struct table payloads = {"payloads", 7, payload_col};
+
+struct life {			/* what happened to a packet so far */
+  int used;			/* is a packet being followed here? */
+  int link;
+  unsigned int payload;		/* its number */
+  unsigned int sends;		/* times it was sent */
+  bigint generated;		/* when it arrived from the source */
+  bigint first_sent;		/* when it was first sent */
+  bigint delivered;		/* when it was delivered; 0 if not */
+};
+
+static struct life (*ring)[RING];	/* per worker */
+static char *where;		/* the directory of this process */
+
+/* Prototypes. */
+static void put(struct table *t, int c, bigint v);
+static void end_row(struct table *t);
+static void flush(struct table *t);
+static void retire(int proc, struct life *e);
+
+
+void start_columns(int shared)
+{
+/* Make dir and room to follow the packets; if shared, forked workers
+ * see each other's changes.  It must be called before any fork.
+ */
+
+  ring = mmap((void *) 0, 2 * sizeof(*ring), PROT_READ | PROT_WRITE,
+	(shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED || (mkdir(columns_at, 0777) < 0 &&
+					access(columns_at, W_OK) < 0)) {
+	printf("Cannot write results to %s\n", columns_at);
+	exit(1);
+  }
+  memset(ring, 0, 2 * sizeof(*ring));
+}
+
+
+void open_columns(char *name)
+{
+/* Create the files of this process in dir/name. */
+
+  int i, k;
+  char path[1024];
+  struct table *t;
+
+  where = malloc(strlen(columns_at) + strlen(name) + 2);
+  sprintf(where, "%s/%s", columns_at, name);
+  mkdir(where, 0777);
+  for (k = 0; k < 2; k++) {
+	t = (k == 0 ? &frames : &payloads);
+	for (i = 0; i < t->ncols; i++) {
+		snprintf(path, sizeof(path), "%s/%s.%s", where, t->name,
+							t->col[i].name);
+		t->col[i].fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		t->col[i].buf = malloc(ROWS * t->col[i].width);
+		if (t->col[i].fd < 0 || t->col[i].buf == NULL) {
+			printf("Cannot write %s\n", path);
+			exit(1);
+		}
+	}
+  }
+}
+
+
+void frame_row(bigint tick, int link, int proc, int event, frame *f)
+{
+/* A frame has been sent, lost or received (COL_SENT etc.). */
+
+  put(&frames, 0, tick/DELTA);
+  put(&frames, 1, link);
+  put(&frames, 2, proc);
+  put(&frames, 3, event);
+  put(&frames, 4, f->kind);
+  put(&frames, 5, f->seq);
+  put(&frames, 6, f->ack);
+  put(&frames, 7, (f->info.data[0] & 0377) << 24 |
+	(f->info.data[1] & 0377) << 16 | (f->info.data[2] & 0377) << 8 |
+	(f->info.data[3] & 0377));
+  end_row(&frames);
+}
+
+
+void payload_fetched(int link, int proc, unsigned int pkt, bigint at)
+{
+/* Worker proc has taken packet pkt, which arrived at tick at. */
+
+  struct life *e = &ring[proc][pkt % RING];
+
+  if (e->used) retire(proc, e);
+  e->used = 1;
+  e->link = link;
+  e->payload = pkt;
+  e->sends = 0;
+  e->generated = at;
+  e->first_sent = 0;
+  e->delivered = 0;
+}
+
+
+void payload_sent(int proc, unsigned int pkt, bigint tick)
+{
+/* Worker proc has sent a data frame holding packet pkt. */
+
+  struct life *e = &ring[proc][pkt % RING];
+
+  if (!e->used || e->payload != pkt) return;
+  if (e->sends == 0) e->first_sent = tick;
+  e->sends++;
+}
+
+
+void payload_delivered(int proc, unsigned int pkt, bigint tick)
+{
+/* Worker proc has delivered packet pkt, sent by the other one. */
+
+  struct life *e = &ring[1 - proc][pkt % RING];
+
+  if (e->used && e->payload == pkt) e->delivered = tick;
+}
+
+
+void flush_payloads(int proc)
+{
+/* Write the rows of the packets worker proc still follows. */
+
+  int i;
+
+  for (i = 0; i < RING; i++)
+	if (ring[proc][i].used) retire(proc, &ring[proc][i]);
+}
+
+
+void close_columns(void)
+{
+/* Write what is left in the buffers and the schema. */
+
+  int i, k;
+  char path[1024];
+  FILE *fp;
+  struct table *t;
+
+  if (where == NULL) return;
+  snprintf(path, sizeof(path), "%s/schema", where);
+  fp = fopen(path, "w");
+  for (k = 0; k < 2; k++) {
+	t = (k == 0 ? &frames : &payloads);
+	flush(t);
+	if (fp != NULL) fprintf(fp, "%s %lu\n", t->name, t->rows);
+	for (i = 0; i < t->ncols; i++) {
+		if (fp != NULL) fprintf(fp, "\t%s %s\n", t->col[i].name,
+							t->col[i].type);
+		close(t->col[i].fd);
+	}
+  }
+  if (fp != NULL) fclose(fp);
+  where = NULL;
+}
+
+
+static void retire(int proc, struct life *e)
+{
+/* The row of a packet that is no longer followed. */
+
+  put(&payloads, 0, e->link);
+  put(&payloads, 1, proc);
+  put(&payloads, 2, e->payload);
+  put(&payloads, 3, e->generated/DELTA);
+  put(&payloads, 4, e->first_sent/DELTA);
+  put(&payloads, 5, e->sends);
+  put(&payloads, 6, e->delivered/DELTA);
+  end_row(&payloads);
+  e->used = 0;
+}
+
+
+static void put(struct table *t, int c, bigint v)
+{
+/* Store value v in column c of the row being made. */
+
+  char *p = t->col[c].buf + t->n * t->col[c].width;
+
+  switch(t->col[c].width) {
+    case 1:	*(unsigned char *) p = v;	break;
+    case 4:	*(unsigned int *) p = v;	break;
+    case 8:	*(bigint *) p = v;		break;
+  }
+}
+
+
+static void end_row(struct table *t)
+{
+  t->rows++;
+  if (++t->n == ROWS) flush(t);
+}
+
+
+static void flush(struct table *t)
+{
+/* Append the buffered rows to the files, one write per column. */
+
+  int i;
+
+  for (i = 0; i < t->ncols && t->n > 0; i++)
+	write(t->col[i].fd, t->col[i].buf, t->n * t->col[i].width);
+  t->n = 0;
+}
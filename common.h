@@ -10,16 +10,75 @@ typedef unsigned long bigint;	/* bigint integer type available */
 				 * timer can go off at a separate tick.
 				 */
 
-/* Reply codes sent by workers back to main. */
+/* Reply codes sent by workers back to main.  A QUIET worker has no timer
+ * running and no packet to send, so only a frame can wake it up; its reply
+ * also says how many frames it has put on the line and taken off it, so
+ * main can tell whether any are still on the way (see quiescent()).
+ */
 #define OK      1		/* normal response */
-#define NOTHING 2		/* worker did nothing */
+#define QUIET   3		/* worker can do nothing until a frame comes */
+#define REPLY(w)    ((w) & 3)			/* OK or QUIET */
+#define SENT(w)     (((w) >> 2) & 0x3FFFFFFF)	/* frames sent (mod 2^30) */
+#define RECEIVED(w) (((w) >> 32) & 0x3FFFFFFF)	/* frames received */
+#define DUMP    1		/* go-ahead asking a worker to show its state
+				 * (times are multiples of DELTA) */
+
+/* Engines that can run a simulation. */
+#define FORK_ENGINE   0		/* main, M0 and M1 are processes (default) */
+#define INPROC_ENGINE 1		/* workers are coroutines inside one process */
+#define BATCH_ENGINE  2		/* protocols 5 and 6 on arrays of links */
+
+/* How main picks the worker to run next (-y).  All but POL_UNIFORM look
+ * only at the workers that have something to do, and when neither has,
+ * move the clock on to when one will.
+ */
+#define POL_UNIFORM  0		/* either one, at random (default) */
+#define POL_READY    1		/* a ready one, at random */
+#define POL_ROUND    2		/* the ready ones in turn */
+#define POL_WEIGHTED 3		/* a ready one, at random by weight */
+#define NEVER (~(bigint) 0)	/* a time that never comes */
+
+/* Statistics kept by each worker, in the order print_statistics() shows
+ * them.  Engines that collect results from many workers pass them around
+ * as arrays of NSTAT bigints indexed by these numbers.
+ */
+#define ST_DATA_SENT      0
+#define ST_PAYLOADS       8
+#define ST_ACKS_SENT      9
+#define ST_NAKS_SENT     14	/* protocol 6 only */
+#define ST_RTO           15	/* timeout in use at the end (with -a) */
+#define ST_SRTT          16	/* smoothed round trip time (with -a) */
+#define ST_OFFERED       17	/* packets from the source (with -t or -u) */
+#define ST_DELAY         18	/* mean delay of a packet (with -t or -u) */
+#define ST_UNDETECTED    19	/* damaged frames taken as good (with -k) */
+#define ST_BIT_ERRORS    20	/* bits flipped by the channel (with -e) */
+#define NSTAT            21
 
 /* Simulation parameters. */
 int protocol;			/* protocol we are simulating */
+int channels;			/* K of protocol 8, its stop-and-wait channels */
 bigint timeout_interval;	/* timeout interval in ticks */
 int pkt_loss;			/* controls packet loss rate: 0 to 990 */
 int garbled;			/* control cksum error rate: 0 to 990 */
-int debug_flags;		/* debug flags */ 
+int debug_flags;		/* debug flags */
+int adaptive;			/* adapt the timeout to the round trip time? */
+int sources;			/* is the network layer not always ready? */
+double precision;		/* stop when this precise (-p); 0: never */
+int warmup;			/* find the warm-up and leave it out (-w)? */
+int common;			/* common random numbers for the channel (-n)? */
+int rare_level;			/* splitting (-x): timeouts in a row to reach */
+int rare_split;			/* and copies made at each level below it */
+int conns;			/* connections multiplexed on each link (-q) */
+char *metrics_at;		/* where to serve live metrics (-m), or NULL */
+int checksum;			/* NO_CRC, CRC32 or CRC32C (-k) */
+double ber;			/* bit error rate (-e); 0: garbled per frame */
+int engine;			/* FORK_ENGINE, INPROC_ENGINE or BATCH_ENGINE */
+int policy;			/* POL_UNIFORM, POL_READY, ... (-y) */
+int weight[2];			/* chances of M0 and M1 (POL_WEIGHTED) */
+bigint seed;			/* seed for all the random number streams */
+bigint first_tick;		/* tick the clock starts at (-S); usually 0 */
+int links;			/* number of independent links simulated */
+int jobs;			/* number of processes sharing the links */
 
 /* File descriptors for pipes. */
 int r1, w1, r2, w2, r3, w3, r4, w4, r5, w5, r6, w6;
@@ -30,3 +89,209 @@ int id;				/* 0 or 1 */
 bigint zero;
 
 int mrfd, mwfd, prfd;
+
+/* Shared by main and the workers (worker.c). */
+void init_worker(int link);
+void release_worker(void);
+void sim_error(char *s);
+unsigned int next_random(bigint *state);
+bigint stream_seed(int link, int who);
+bigint mix(bigint z);
+int state_size(void);
+void save_state(char *p);
+void load_state(char *p);
+void collect_statistics(bigint s[]);
+void show_statistics(int proc, bigint s[]);
+int quiescent(bigint word[2]);
+void show_window(void);
+int timeouts_in_a_row(void);
+bigint next_due(void);
+void reseed_worker(bigint salt);
+
+#define GP_BINS 256		/* bins of the goodputs of connections (-q) */
+
+struct result {			/* what one link reports when it is done */
+  int link;			/* link number */
+  int alive[2];			/* which workers were still running */
+  bigint time;			/* tick at which the link stopped */
+  char reason[40];		/* why it stopped ("" if a worker died) */
+  bigint stats[2][NSTAT];	/* statistics of M0 and M1 */
+  int batches;			/* batch means behind mean[] (-p) */
+  double mean[2], half[2];	/* goodput and retransmission ratio (-p) */
+  int warm_found;		/* was the end of the warm-up found (-w)? */
+  bigint warm;			/* tick it ended at; stats[] start there */
+  double rare;			/* estimated chance of the rare event (-x) */
+  bigint paths;			/* runs the link was split into (-x) */
+  bigint rare_events;		/* events simulated on all of them (-x) */
+  int conns;			/* connections it carried (-q) */
+  int stuck;			/* how many of them deadlocked */
+  double gp_sum, gp_sumsq;	/* their goodputs: sum and sum of squares */
+  double gp_min, gp_max;
+  int gp_hist[GP_BINS];		/* how many fell in each 1/GP_BINS of 0 to 1 */
+  bigint on_air, carried;	/* frames put on the medium, and intact (-g) */
+  bigint collided, deferred;	/* frames garbled, and waits for quiet (-g) */
+};
+
+/* Sequential stopping (-p, engine.c).  The run is cut into batches of
+ * batch_ticks(); the goodput and the fraction of data frames that were
+ * retransmissions are averaged per batch, and the link stops once the 95%
+ * confidence interval of both is narrower than precision times the mean.
+ */
+struct means {			/* batch means of one link */
+  int warm;			/* has the first batch ended? */
+  int batches;			/* batches counted (the first one is not) */
+  bigint last[3];		/* counters at the end of the last batch */
+  double sum[2], sumsq[2];	/* per metric: sum and sum of squares */
+};
+
+#define PRG_PAYLOADS 0		/* the counters add_batch() is given */
+#define PRG_SENT     1
+#define PRG_RETRANS  2
+
+bigint batch_ticks(void);
+int add_batch(struct means *mt, bigint c[3]);
+void end_means(struct means *mt, struct result *r);
+void count_progress(bigint c[3]);
+double t95(int df);
+
+/* Live metrics (metrics.c).  Statistics are published every PUBLISH
+ * events; st may be 0.
+ */
+#define PUBLISH 4096
+
+void start_metrics(int n, bigint last_tick);
+void stop_metrics(void);
+void publish(int k, bigint events, int nlinks, int done, bigint st[2][NSTAT]);
+
+/* Columnar result files (columns.c).  Frame rows say what happened. */
+#define COL_SENT 0		/* put on the line */
+#define COL_LOST 1		/* put on the line and lost */
+#define COL_GOOD 2		/* arrived intact */
+#define COL_BAD  3		/* arrived with a checksum error */
+
+char *columns_at;		/* where to write result files (-o), or NULL */
+void start_columns(int shared);
+void open_columns(char *name);
+void frame_row(bigint tick, int link, int proc, int event, frame *f);
+void payload_fetched(int link, int proc, unsigned int pkt, bigint at);
+void payload_sent(int proc, unsigned int pkt, bigint tick);
+void payload_delivered(int proc, unsigned int pkt, bigint tick);
+void flush_payloads(int proc);
+void close_columns(void);
+
+/* Real checksums (crc.c). */
+#define NO_CRC 0		/* checksum errors are only a coin flip */
+#define CRC32  1		/* IEEE 802.3 */
+#define CRC32C 2		/* Castagnoli */
+
+void init_crc(void);
+int wire_frame(frame *f, unsigned char *p);
+void unwire_frame(unsigned char *p, frame *f);
+unsigned int frame_crc(frame *f);
+
+/* Result cache (cache.c). */
+char *cache_at;			/* where results are cached (-c), or NULL */
+void use_cache(char *key);
+void clear_cache(void);
+
+/* Traffic sources (source.c). */
+#define SRC_SATURATED 0		/* a packet is always ready (default) */
+#define SRC_CBR       1		/* constant bit rate */
+#define SRC_POISSON   2		/* Poisson arrivals */
+#define SRC_ONOFF     3		/* bursts at a constant rate */
+#define SRC_TRACE     4		/* arrival times from a file */
+#define SRC_BLOCK   256		/* arrival times made at a time */
+
+struct source {			/* one direction's network layer */
+  int model;			/* SRC_SATURATED, SRC_CBR, ... */
+  int dir;			/* 0: M0 to M1, 1: M1 to M0 */
+  bigint rng;			/* its random number stream */
+  double clock;			/* time of the last arrival made */
+  double on_until;		/* end of the current on period */
+  long next;			/* next time of a trace */
+  int n, k;			/* at[k] to at[n-1] are still to come */
+  bigint at[SRC_BLOCK];		/* arrival times, in ticks */
+};
+
+void reset_sources(void);
+int parse_source(int dir, char *arg);
+void init_source(struct source *q, int dir, int link);
+int source_ready(struct source *q, bigint now);
+bigint source_next(struct source *q);
+int source_waiting(struct source *q, bigint now);
+int source_pending(struct source *q);
+bigint source_due(struct source *q);
+
+/* In-process and batch engines (engine.c, batch.c). */
+void run_engine(bigint last_tick);
+void run_all(bigint last_tick, struct result *res);
+void init_engine(void);
+void begin_link(int l);
+bigint engine_yield(bigint word, bigint due, char *frames);
+void engine_deliver(int i, frame *f);
+void engine_exit(int status);
+int engine_pending(void);
+void engine_receive(frame *f, int k);
+void engine_send(frame *s);
+void run_batch(int first, int step, bigint last_tick, struct result *res);
+void run_mux(int first, int step, bigint last_tick, struct result *res);
+void run_quietly(bigint last_tick, struct result *res);
+
+/* Shared medium (medium.c).  Stations 2c and 2c + 1 are the two ends of
+ * connection c.
+ */
+#define MED_NONE  0		/* a pair of pipes per connection (default) */
+#define MED_ALOHA 1		/* send at once */
+#define MED_CSMA  2		/* listen first, and wait while it is busy */
+
+int medium;			/* MED_NONE, MED_ALOHA or MED_CSMA (-g) */
+int stations;			/* stations sharing it, two per connection */
+int air;			/* events a frame holds it for */
+
+void start_medium(int l);
+void medium_send(int i, bigint now, frame *f);
+void medium_step(bigint now);
+void end_medium(struct result *r);
+void show_medium(struct result *res, int n);
+
+/* Simulation server (serve.c).  A reply is followed by text bytes of what
+ * the run printed and then by links results.
+ */
+char *serve_at;			/* socket to serve runs on (-z), or NULL */
+
+struct reply {			/* the server's answer to a request */
+  int status;			/* 0: run; otherwise refused */
+  int links;			/* results that follow the text */
+  long text;			/* bytes of text that follow this */
+};
+
+int parse_args(int argc, char *argv[]);
+void serve_runs(void);
+
+/* Timeout optimization (optimize.c). */
+int opt_lo, opt_hi;		/* timeouts to search between (-f); 0: none */
+int opt_delay;			/* minimize the packet delay, not efficiency? */
+
+int optimize(void);
+
+/* Exhaustive exploration (explore.c, and engine.c to take a link apart). */
+int verify;			/* packets to deliver each way (-v); 0: simulate */
+int in_flight;			/* frames on their way each way, at most (-v) */
+int searching;			/* exploring, rather than showing a run found */
+
+int explore(void);
+int choose_way(int n);
+bigint hash_more(bigint h, char *p, int n);
+void load_worker(int i);
+int step_link(int process, bigint ct);
+int link_flight(int i);
+bigint link_delivered(int i);
+int save_link(char *p);
+void restore_link(char *p);
+bigint hash_link(void);
+void tidy_worker(void);
+bigint hash_worker(bigint h);
+int save_model(char *p);
+int load_model(char *p);
+int frames_queued(void);
+bigint packets_delivered(void);
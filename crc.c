@@ -0,0 +1,138 @@
+/* Real checksums (-k).
+ *
+ * Normally a checksum error is a coin flipped against the garbled rate when
+ * a frame arrives; the frame itself is never looked at.  With -k crc32 or
+ * -k crc32c the sender puts a CRC of the frame's bytes into it, the channel
+ * damages the frames it garbles by flipping bits in them (the CRC included),
+ * and the receiver computes the CRC again to decide whether the frame is
+ * good.  So the time spent checksumming is part of the simulation, and so
+ * are the errors a CRC does not catch: a damaged frame whose CRC still
+ * matches is handed to the protocol as it is, and counted.
+ *
+ * A frame is checksummed as it would go on a line: the kind, then seq and
+ * ack as 4 little-endian bytes each, then the MAX_PKT bytes of the packet.
+ * CRC-32 is computed 8 bytes at a time with tables (slicing-by-8).  CRC-32C
+ * uses the same method, unless the CPU has the SSE4.2 crc32 instruction.
+ */
+
+#include <string.h>
+#include "common.h"
+
+#define POLY_CRC32  0xEDB88320	/* IEEE 802.3, bit reversed */
+#define POLY_CRC32C 0x82F63B78	/* Castagnoli, bit reversed */
+
+static unsigned int table[8][256];	/* slicing-by-8 for the polynomial */
+static unsigned int (*kernel)(unsigned char *p, int n);
+
+/* Prototypes. */
+static unsigned int crc_table(unsigned char *p, int n);
+#if defined(__x86_64__)
+static unsigned int crc_sse42(unsigned char *p, int n);
+#endif
+
+
+void init_crc(void)
+{
+/* Build the tables for the CRC picked with -k and pick the fastest code. */
+
+  int i, k;
+  unsigned int c, poly;
+
+  poly = (checksum == CRC32C ? POLY_CRC32C : POLY_CRC32);
+  for (i = 0; i < 256; i++) {
+	c = i;
+	for (k = 0; k < 8; k++) c = (c >> 1) ^ (c & 1 ? poly : 0);
+	table[0][i] = c;
+  }
+  for (i = 0; i < 256; i++)
+	for (k = 1; k < 8; k++)
+		table[k][i] = (table[k-1][i] >> 8) ^ table[0][table[k-1][i] & 0377];
+  kernel = crc_table;
+#if defined(__x86_64__)
+  if (checksum == CRC32C && __builtin_cpu_supports("sse4.2")) kernel = crc_sse42;
+#endif
+}
+
+
+int wire_frame(frame *f, unsigned char *p)
+{
+/* Lay out frame f as bytes in p, without its CRC; return how many. */
+
+  int i;
+
+  p[0] = f->kind;
+  for (i = 0; i < 4; i++) {
+	p[1 + i] = (f->seq >> (8 * i)) & 0377;
+	p[5 + i] = (f->ack >> (8 * i)) & 0377;
+  }
+  memcpy(p + 9, f->info.data, MAX_PKT);
+  return(9 + MAX_PKT);
+}
+
+
+void unwire_frame(unsigned char *p, frame *f)
+{
+/* The opposite of wire_frame(). */
+
+  int i;
+
+  f->kind = p[0];
+  f->seq = 0;
+  f->ack = 0;
+  for (i = 0; i < 4; i++) {
+	f->seq |= (seq_nr) p[1 + i] << (8 * i);
+	f->ack |= (seq_nr) p[5 + i] << (8 * i);
+  }
+  memcpy(f->info.data, p + 9, MAX_PKT);
+}
+
+
+unsigned int frame_crc(frame *f)
+{
+/* The CRC of frame f, as the sender computes it and the receiver checks. */
+
+  unsigned char buf[9 + MAX_PKT];
+
+  return((*kernel)(buf, wire_frame(f, buf)));
+}
+
+
+static unsigned int crc_table(unsigned char *p, int n)
+{
+/* Any CRC, 8 bytes per step, then 1 byte per step. */
+
+  unsigned int c = ~0U, lo, hi;
+
+  while (n >= 8) {
+	lo = c ^ (p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24);
+	hi = p[4] | p[5] << 8 | p[6] << 16 | (unsigned int) p[7] << 24;
+	c = table[7][lo & 0377] ^ table[6][(lo >> 8) & 0377] ^
+	    table[5][(lo >> 16) & 0377] ^ table[4][lo >> 24] ^
+	    table[3][hi & 0377] ^ table[2][(hi >> 8) & 0377] ^
+	    table[1][(hi >> 16) & 0377] ^ table[0][hi >> 24];
+	p += 8;
+	n -= 8;
+  }
+  while (n-- > 0) c = (c >> 8) ^ table[0][(c ^ *p++) & 0377];
+  return(~c);
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static unsigned int crc_sse42(unsigned char *p, int n)
+{
+/* CRC-32C with the crc32 instruction, 8 bytes per step. */
+
+  unsigned long c = ~0U, w;
+
+  while (n >= 8) {
+	memcpy(&w, p, 8);
+	c = __builtin_ia32_crc32di(c, w);
+	p += 8;
+	n -= 8;
+  }
+  while (n-- > 0) c = __builtin_ia32_crc32qi(c, *p++);
+  return(~c);
+}
+#endif
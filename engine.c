@@ -0,0 +1,1256 @@
+/* In-process engine for the simulator.
+ *
+ * The fork engine in sim.c runs main, M0 and M1 as three processes and
+ * moves every tick and every frame through a pipe.  That is faithful but
+ * slow, and one run can only simulate one link.  This engine runs the same
+ * protocols (p2.c to p6.c) on top of the same library (worker.c), but each
+ * worker is a coroutine inside one process and main's loop is an ordinary
+ * function.  A coroutine is started with makecontext() on a stack of its own;
+ * after that, switches use _setjmp()/_longjmp(), which unlike swapcontext()
+ * do not make a system call to save the signal mask.  Switching from one
+ * worker to the other also copies the per-worker globals listed in worker.c.
+ *
+ * A run may simulate many independent links.  They are dealt out round
+ * robin to `jobs' processes, which run concurrently on as many cores as the
+ * machine has.  Every link has its own random number streams (see
+ * stream_seed() in worker.c), so the result for a link depends only on the
+ * seed and the link number, not on the number of processes.  Links never
+ * exchange frames, so one partition never has to wait for another: the
+ * lookahead between partitions is unbounded, and the only synchronization
+ * needed is at the end, when the parent collects the results.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <ucontext.h>
+#include <setjmp.h>
+#include <math.h>
+#include "common.h"
+
+#define STACK_SIZE (64 * 1024)	/* stack for each worker coroutine */
+#define CONN_STACK (16 * 1024)	/* the same when a link has many (-g) */
+#define PIPE_START 64		/* initial size of an in-process pipe */
+#define RUNNING (-1)		/* status of a worker that has not exited */
+#define MIN_BATCHES 10		/* batch means needed before stopping (-p) */
+#define MSER_BATCH 5		/* goodput samples per MSER batch (-w) */
+#define MIN_MSER 20		/* MSER batches before the rule is tried */
+#define MAX_MSER 1024		/* MSER batches before giving up */
+#ifdef __GLIBC__		/* the registers; _setjmp() leaves the rest */
+#define JB_SIZE offsetof(struct __jmp_buf_tag, __saved_mask)
+#else
+#define JB_SIZE sizeof(jmp_buf)
+#endif
+
+struct machine {		/* M0 or M1 of the link being simulated */
+  ucontext_t uc;		/* how its coroutine starts */
+  jmp_buf jb;			/* where its coroutine left off */
+  int started;			/* has the coroutine been entered yet? */
+  char *stack;			/* the coroutine's stack */
+  char *state;			/* its per-worker globals, when not loaded */
+  frame *pipe;			/* frames sent to it by the peer */
+  int head, tail, size;		/* pipe[head] to pipe[tail-1] are unread */
+  bigint ct;			/* go-ahead (the time) from main */
+  bigint word;			/* its last reply to main */
+  int status;			/* RUNNING, or the status it exited with */
+  char *sp;			/* its stack pointer when it last replied (-v) */
+  char *frames;			/* where its protocol's frames begin (-v) */
+  bigint due;			/* when it has something to do next (-y) */
+};
+
+static struct machine *m;	/* the two workers of the current connection */
+static struct machine *pairs;	/* those of every connection, two each */
+static struct machine *running;	/* worker whose coroutine is running */
+static struct machine *loaded;	/* worker whose globals are loaded */
+static ucontext_t main_uc;	/* main's context, for the first entry */
+static jmp_buf main_jb;		/* main's context while a worker runs */
+static char *pristine;		/* the per-worker globals before any run */
+static int link_nr;		/* link being simulated */
+static bigint done[2][NSTAT];	/* statistics of the links finished (-m) */
+static bigint done_events;	/* and the events they took */
+static int done_links;
+static int stack_size;		/* STACK_SIZE, or CONN_STACK with -g */
+
+/* Stations (-g).  A link on a shared medium carries conns connections,
+ * each a pair of workers with its own globals, stack, window, timers and
+ * sequence numbers, and its own random number streams: connection c of
+ * link l draws them as link l * conns + c would.  The pairs, their globals
+ * and their stacks are each allocated as one block.  The connections share
+ * the link's events: main hands them out round robin among the connections
+ * that are not stuck, one at a time, and then picks M0 or M1 of the
+ * connection as it always does.  A connection whose workers are both quiet
+ * with nothing on the way never does anything again, so it drops out of
+ * the rotation.  A worker seldom needs much stack, so with many connections
+ * each gets CONN_STACK, and its queue[] starts small and grows only with a
+ * backlog (worker.c).  Connections that share a pair of pipes instead (-q)
+ * are run by mux.c, without coroutines.
+ */
+static bigint *turns;		/* events each connection has been given */
+static int *ready;		/* connections not stuck, in round robin order */
+static int nready;		/* how many there are */
+static int cursor;		/* the one to be given the next event */
+static int last_pick;		/* worker picked last (-y round) */
+
+/* Warm-up truncation (-w) by the MSER-5 rule.  The goodput is sampled once
+ * per timeout interval (but at most every 10 events), and mser_z[] holds
+ * the means of MSER_BATCH samples at a time.  After batch n, the truncation
+ * point is the d that minimizes the variance of the mean of mser_z[d..n-1]
+ * divided by n - d; once that d lies in the first half, the warm-up is
+ * taken to end after batch d, and the statistics are counted from there,
+ * using the snapshot mser_snap[d] of the counters.
+ */
+static double mser_z[MAX_MSER];
+static bigint mser_snap[MAX_MSER/2 + 1][2][NSTAT];
+
+/* Splitting (-x), for the chance that a worker sees rare_level timeouts in
+ * a row within the run.  Whenever a run of a link first gets to a level,
+ * i timeouts in a row with 0 < i < rare_level, it is split: rare_split - 1
+ * copies of the process are forked, one after the other, each with random
+ * number streams of its own, and run on from there like the original.  So
+ * every run that gets to level i stands for rare_split^-i of the original
+ * one, and the sum of these weights over the runs that get to the top is
+ * an unbiased estimate of the chance.  A copy sends its sum, and the runs
+ * and events it took, down a pipe to the process it was forked from.
+ */
+static double rare_sum;		/* weights of the runs that got there */
+static bigint rare_paths;	/* copies made */
+static bigint rare_events;	/* events they simulated */
+static int clone_fd = -1;	/* where a copy sends its sums; -1: original */
+static bigint born;		/* tick a copy was made at */
+
+/* Prototypes. */
+void sender2(void);
+void receiver2(void);
+void sender3(void);
+void receiver3(void);
+void protocol4(void);
+void protocol5(void);
+void protocol6(void);
+void protocol7(void);
+void protocol8(void);
+static void start(void);
+static void resume(struct machine *mp, bigint ct);
+static void run_links(int first, int step, bigint last_tick, struct result *res);
+static void run_link(int l, bigint last_tick, struct result *r);
+static int pick(bigint *rng, bigint *tick, bigint last_tick);
+static int next_conn(void);
+static void collect_conns(struct result *r);
+static void show_goodputs(struct result *res, int n);
+static void progress(bigint c[3]);
+static void snapshot(bigint st[2][NSTAT]);
+static int mser(int n);
+static void cut_warmup(struct result *r, bigint base[2][NSTAT]);
+static int split(bigint *rng, bigint tick);
+static char *put(char *q, void *x, int n);
+static char *get(char *p, void *x, int n);
+static char *stack_pointer(void) __attribute__((noinline));
+static void share(bigint tick);
+static void report(struct result *res, bigint last_tick);
+
+
+void run_engine(bigint last_tick)
+{
+/* Simulate all the links and print the results. */
+
+  struct result *res;
+
+  res = (struct result *) calloc(links, sizeof(struct result));
+  if (res == NULL) {
+	printf("Out of memory\n");
+	exit(1);
+  }
+  run_all(last_tick, res);
+  report(res, last_tick);
+}
+
+
+void run_all(bigint last_tick, struct result *res)
+{
+/* Simulate all the links, spread over the jobs, and leave the results in
+ * res.
+ */
+
+  int l, j, n, got, fd[2];
+  struct result r;
+
+  init_engine();
+  if (jobs > links) jobs = links;
+  if (metrics_at != NULL) start_metrics(jobs, last_tick);  /* one per job */
+  if (columns_at != NULL) start_columns(0);
+
+  if (jobs <= 1) {
+	run_links(0, 1, last_tick, res);
+	stop_metrics();
+  } else {
+	/* Partition j simulates links j, j + jobs, j + 2*jobs, etc.  A result
+	 * is smaller than PIPE_BUF, so the partitions can share one pipe.
+	 */
+	if (pipe(fd) < 0) {
+		printf("Cannot create result pipe\n");
+		exit(1);
+	}
+	for (j = 0; j < jobs; j++) {
+		if (fork() == 0) {
+			close(fd[0]);
+			run_links(j, jobs, last_tick, res);
+			for (l = j; l < links; l += jobs)
+				write(fd[1], &res[l], sizeof(res[l]));
+			exit(0);
+		}
+	}
+	close(fd[1]);
+	for (n = 0; n < links; n++) {
+		got = read(fd[0], &r, sizeof(r));
+		if (got != sizeof(r)) {
+			printf("Lost the results of %d links\n", links - n);
+			exit(1);
+		}
+		res[r.link] = r;
+	}
+	stop_metrics();		/* before the wait, which would wait for it too */
+	while (wait((int *) 0) > 0) ;
+  }
+}
+
+
+void init_engine(void)
+{
+/* Make room for the two workers of each connection, before any of them
+ * has run; with -q, mux.c has its own, so one pair does.  The server
+ * (serve.c) runs one simulation after another in the same process, so what
+ * was made for an earlier one is kept if it is big enough, and the globals
+ * before any run are saved only once.
+ */
+
+  int i, k, size;
+  char *stacks, *states;
+  static int room;		/* connections there is room for */
+
+  if (pristine == NULL) {
+	pristine = malloc(state_size());
+	if (pristine == NULL) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+	save_state(pristine);	/* nothing has run yet */
+  }
+  m = pairs;
+  k = (medium != MED_NONE ? conns : 1);	/* pairs of workers */
+  size = (k > 1 ? CONN_STACK : STACK_SIZE);
+  if (k <= room && size <= stack_size) return;
+  if (room > 0) {
+	for (i = 0; i < 2 * room; i++) free(pairs[i].pipe);
+	free(pairs[0].stack);
+	free(pairs[0].state);
+	free(pairs);
+	free(turns);
+	free(ready);
+  }
+  room = k;
+  stack_size = size;
+  pairs = (struct machine *) calloc(2 * k, sizeof(struct machine));
+  stacks = malloc(2 * (long) k * stack_size);
+  states = malloc(2 * (long) k * state_size());
+  turns = (bigint *) calloc(k, sizeof(bigint));
+  ready = (int *) calloc(k, sizeof(int));
+  if (pairs == NULL || stacks == NULL || states == NULL || turns == NULL ||
+							ready == NULL) {
+	printf("Out of memory\n");
+	exit(1);
+  }
+  for (i = 0; i < 2 * k; i++) {
+	pairs[i].stack = stacks + (long) i * stack_size;
+	pairs[i].state = states + (long) i * state_size();
+  }
+  m = pairs;
+}
+
+
+void run_quietly(bigint last_tick, struct result *res)
+{
+/* Simulate all the links in this process and leave the results in res,
+ * printing nothing but what the workers print (the server, serve.c).
+ */
+
+  init_engine();
+  run_links(0, 1, last_tick, res);
+}
+
+
+static void run_links(int first, int step, bigint last_tick, struct result *res)
+{
+/* Simulate links first, first + step, first + 2*step, etc. */
+
+  int l;
+  char name[20];
+
+  if (engine == BATCH_ENGINE) {
+	run_batch(first, step, last_tick, res);	/* all at once; batch.c */
+	return;
+  }
+  if (conns > 1 && medium == MED_NONE) {
+	run_mux(first, step, last_tick, res);	/* many on one pipe; mux.c */
+	return;
+  }
+  if (columns_at != NULL) {	/* one directory per job */
+	sprintf(name, "job%d", first);
+	open_columns(name);
+  }
+  for (l = first; l < links; l += step) run_link(l, last_tick, &res[l]);
+  if (columns_at != NULL) close_columns();
+}
+
+
+static void run_link(int l, bigint last_tick, struct result *r)
+{
+/* Simulate one link from start to finish.  The loop is main() of sim.c,
+ * with a function call taking the place of each pipe transaction.
+ */
+
+  int i, process, stuck, looking, nz, nobs, d, top;
+  bigint tick, word[2], rng, batch, c[3], sample, last_pay;
+  double sum, weight;
+  char *reason;
+  struct means mt;
+
+  rng = stream_seed(l, 2);	/* main's stream for this link */
+  begin_link(l);
+  tick = first_tick;
+  stuck = 0;
+  reason = "End of simulation";
+  memset(&mt, 0, sizeof(mt));
+  batch = (precision > 0 ? batch_ticks() : 0);
+  sample = (timeout_interval > 10 * DELTA ? timeout_interval : 10 * DELTA);
+  looking = warmup;
+  nz = nobs = 0;
+  sum = 0;
+  last_pay = 0;
+  d = 0;
+  memset(mser_snap[0], 0, sizeof(mser_snap[0]));
+  top = 0;
+  weight = 1;
+  rare_sum = 0;
+  rare_paths = rare_events = 0;
+  while (tick < last_tick) {
+	if (policy == POL_UNIFORM)
+		process = next_random(&rng) & 1;	/* pick process: 0 or 1 */
+	tick = tick + DELTA;
+	if (medium != MED_NONE) medium_step(tick);
+	if (conns > 1 && !next_conn()) {
+		reason = "All connections are deadlocked";
+		break;
+	}
+	if (policy != POL_UNIFORM &&
+			(process = pick(&rng, &tick, last_tick)) < 0) break;
+	if (m[process].status != RUNNING) {
+		reason = "";	/* as when main finds a worker's pipe closed */
+		break;
+	}
+	word[0] = m[0].word;
+	word[1] = m[1].word;
+	if (quiescent(word)) {
+		reason = "A deadlock has been detected";
+		stuck = 1;
+		break;
+	}
+	resume(&m[process], tick);
+	while (rare_level > 0 && timeouts_in_a_row() > top) {
+		if (++top == rare_level) break;
+		weight /= rare_split;
+		split(&rng, tick);
+	}
+	if (rare_level > 0 && top == rare_level) {
+		rare_sum += weight;
+		reason = "Rare event reached";
+		break;
+	}
+	if (metrics_at != NULL && tick % (PUBLISH * DELTA) == 0) share(tick);
+	if (batch > 0 && tick % batch == 0) {
+		progress(c);
+		if (add_batch(&mt, c)) {
+			reason = "Precision reached";
+			break;
+		}
+	}
+	if (looking && tick % sample == 0) {
+		progress(c);
+		sum += (double) (c[PRG_PAYLOADS] - last_pay) / (sample/DELTA);
+		last_pay = c[PRG_PAYLOADS];
+		if (++nobs < MSER_BATCH) continue;
+		mser_z[nz++] = sum / MSER_BATCH;
+		sum = 0;
+		nobs = 0;
+		if (nz <= MAX_MSER/2) snapshot(mser_snap[nz]);
+		if ((d = mser(nz)) >= 0) {
+			looking = 0;	/* found: batch means start afresh */
+			mt.batches = 0;
+			memset(mt.sum, 0, sizeof(mt.sum));
+			memset(mt.sumsq, 0, sizeof(mt.sumsq));
+		} else if (nz == MAX_MSER) {
+			looking = 0;	/* give up */
+		}
+	}
+  }
+
+  /* A copy made for splitting is done: report to its parent. */
+  if (clone_fd >= 0) {
+	rare_events += (tick - born)/DELTA;
+	write(clone_fd, &rare_sum, sizeof(rare_sum));
+	write(clone_fd, &rare_paths, sizeof(rare_paths));
+	write(clone_fd, &rare_events, sizeof(rare_events));
+	_exit(0);
+  }
+
+  /* Collect the statistics straight from each worker's globals. */
+  if (loaded != NULL) save_state(loaded->state);
+  loaded = NULL;
+  r->link = l;
+  r->time = tick;
+  strncpy(r->reason, reason, sizeof(r->reason) - 1);
+  r->reason[sizeof(r->reason) - 1] = 0;
+  end_means(&mt, r);
+  if (stuck && links > 1) printf("Link %d:\n", l);
+  if (medium != MED_NONE) end_medium(r);
+  if (conns > 1) collect_conns(r);
+  else for (i = 0; i < 2; i++) {
+	load_state(m[i].state);
+	if (stuck) show_window();
+	collect_statistics(r->stats[i]);
+	r->alive[i] = (m[i].status == RUNNING);
+	release_worker();
+  }
+  r->warm_found = (warmup && !looking && d >= 0);
+  r->warm = (r->warm_found ? d * MSER_BATCH * sample : 0);
+  if (r->warm_found) cut_warmup(r, mser_snap[d]);
+  r->rare = rare_sum;
+  r->paths = rare_paths + 1;
+  r->rare_events = rare_events + tick/DELTA;
+  if (metrics_at != NULL) {
+	for (i = 0; i < 2 * NSTAT; i++) done[i/NSTAT][i%NSTAT] +=
+						r->stats[i/NSTAT][i%NSTAT];
+	done_events += tick/DELTA;
+	done_links++;
+	publish(l % jobs, done_events, done_links, done_links, done);
+  }
+}
+
+
+void begin_link(int l)
+{
+/* Set up the workers of link l.  Like the forked workers, each one runs up
+ * to its first wait_for_event() before main starts handing out ticks.
+ */
+
+  int i, c;
+  struct machine *mp;
+
+  link_nr = l;
+  loaded = NULL;		/* whatever is loaded belongs to no worker now */
+  for (i = 0; i < 2 * conns; i++) {
+	mp = &pairs[i];
+	memcpy(mp->state, pristine, state_size());
+	mp->head = 0;
+	mp->tail = 0;
+	mp->word = OK;
+	mp->due = 0;
+	mp->status = RUNNING;
+	mp->started = 0;
+	getcontext(&mp->uc);
+	mp->uc.uc_stack.ss_sp = mp->stack;
+	mp->uc.uc_stack.ss_size = stack_size;
+	mp->uc.uc_link = (ucontext_t *) 0;
+	makecontext(&mp->uc, start, 0);
+  }
+  if (medium != MED_NONE) start_medium(l);	/* before anything is sent */
+  for (c = 0; c < conns; c++) {
+	m = &pairs[2 * c];
+	for (i = 0; i < 2; i++) resume(&m[i], 0);
+	turns[c] = 0;
+	ready[c] = c;
+  }
+  m = pairs;
+  nready = conns;
+  cursor = 0;
+  last_pick = 1;		/* so round robin starts with M0 */
+}
+
+
+static void start(void)
+{
+/* The first code a worker coroutine runs, the same as a forked worker. */
+
+  id = running - m;
+  init_worker(link_nr * conns + (m - pairs) / 2);	/* see -g above */
+  switch(protocol) {
+	case 2:	if (id == 0) sender2(); else receiver2();	break;
+	case 3:	if (id == 0) sender3(); else receiver3();	break;
+	case 4: protocol4();	break;
+	case 5: protocol5();	break;
+	case 6: protocol6();	break;
+	case 7: protocol7();	break;
+	case 8: protocol8();	break;
+  }
+  printf("Impossible.  Protocol terminated\n");
+  engine_exit(1);
+}
+
+
+static void resume(struct machine *mp, bigint ct)
+{
+/* Let worker mp run with time ct until it replies to main again. */
+
+  if (loaded != mp) {
+	if (loaded != NULL) save_state(loaded->state);
+	load_state(mp->state);
+	loaded = mp;
+  }
+  running = mp;
+  mp->ct = ct;
+  if (_setjmp(main_jb) == 0) {
+	if (mp->started) _longjmp(mp->jb, 1);
+	mp->started = 1;
+	swapcontext(&main_uc, &mp->uc);
+  }
+  running = NULL;
+}
+
+
+bigint engine_yield(bigint word, bigint due, char *frames)
+{
+/* Called by a worker in place of writing word to main and reading the
+ * next go-ahead.  Due is when it will next have something to do (-y).
+ * Frames is where the stack above wait_for_event() begins, return address
+ * and all.
+ */
+
+  struct machine *mp = running;
+
+  mp->word = word;
+  mp->due = due;
+  if (verify) {
+	mp->sp = stack_pointer();
+	mp->frames = frames;
+  }
+  if (_setjmp(mp->jb) == 0) _longjmp(main_jb, 1);
+  return(mp->ct);
+}
+
+
+void engine_exit(int status)
+{
+/* Called by a worker in place of exit().  Its coroutine is never resumed. */
+
+  struct machine *mp = running;
+
+  mp->status = status;
+  _longjmp(main_jb, 1);
+}
+
+
+int engine_pending(void)
+{
+/* Number of frames the peer has sent to the running worker. */
+
+  return(running->tail - running->head);
+}
+
+
+void engine_receive(frame *f, int k)
+{
+/* Take k frames out of the running worker's pipe. */
+
+  struct machine *mp = running;
+
+  memcpy(f, &mp->pipe[mp->head], k * sizeof(frame));
+  mp->head += k;
+  if (mp->head == mp->tail) {
+	mp->head = 0;		/* empty: start again at the bottom */
+	mp->tail = 0;
+  }
+}
+
+
+void engine_send(frame *s)
+{
+/* Put frame s in the peer's pipe, or on the shared medium (-g), which
+ * delivers it later with engine_deliver().
+ */
+
+  if (medium != MED_NONE)
+	medium_send(running - pairs, running->ct, s);
+  else
+	engine_deliver((running - pairs) ^ 1, s);
+}
+
+
+void engine_deliver(int i, frame *f)
+{
+/* Put frame f in the pipe of worker i of the link: worker 2c + 1 is the
+ * peer of worker 2c.
+ */
+
+  struct machine *mp = &pairs[i];
+
+  if (mp->tail == mp->size) {
+	mp->size = (mp->size == 0 ? PIPE_START : 2 * mp->size);
+	mp->pipe = (frame *) realloc(mp->pipe, mp->size * sizeof(frame));
+	if (mp->pipe == NULL) sim_error("Out of memory for pipe");
+  }
+  mp->pipe[mp->tail++] = *f;
+}
+
+
+/* Exploration (-v, explore.c) needs to take the state of a link apart and
+ * put it back.  The state is what each worker's globals, stack, registers
+ * and queue hold, plus the frames in its pipe.  Of the globals only those
+ * save_model() in worker.c keeps are needed.  A worker's registers are in
+ * its jmp_buf, and its stack is the part above where it last replied to
+ * main; since every state is put back at the same addresses it was taken
+ * from, the pointers in them stay good.
+ *
+ * Two states are told apart by less: the globals and frames as above, and
+ * the stack of the protocol.  wait_for_event() is returns_twice (see
+ * protocol.h), so a protocol keeps nothing in registers across it, and
+ * nothing in the frames below it, or in the jmp_buf, is read again before
+ * it is written: they hold the dead locals of the library, which would
+ * make one state look like many.
+ */
+
+void load_worker(int i)
+{
+/* Make the globals of worker i the ones in use. */
+
+  if (loaded != &m[i]) {
+	if (loaded != NULL) save_state(loaded->state);
+	load_state(m[i].state);
+	loaded = &m[i];
+  }
+}
+
+
+int step_link(int process, bigint ct)
+{
+/* Let one worker run with time ct, as main does; 0 if it gave up. */
+
+  resume(&m[process], ct);
+  return(m[process].status == RUNNING);
+}
+
+
+int link_flight(int i)
+{
+/* Frames on their way to worker i: in its pipe or in its queue. */
+
+  load_worker(i);
+  return(m[i].tail - m[i].head + frames_queued());
+}
+
+
+bigint link_delivered(int i)
+{
+/* Packets worker i has passed to its network layer. */
+
+  load_worker(i);
+  return(packets_delivered());
+}
+
+
+int save_link(char *p)
+{
+/* Copy the state of the link to p; return its size in bytes. */
+
+  int i, n;
+  char *q = p;
+
+  for (i = 0; i < 2; i++) {
+	load_worker(i);
+	n = m[i].tail - m[i].head;
+	q = put(q, &m[i].jb, JB_SIZE);
+	q = put(q, &m[i].status, sizeof(int));
+	q = put(q, &m[i].sp, sizeof(char *));
+	q = put(q, &m[i].frames, sizeof(char *));
+	q = put(q, &n, sizeof(int));
+	q = put(q, &m[i].pipe[m[i].head], n * sizeof(frame));
+	q += save_model(q);
+	q = put(q, m[i].sp, m[i].stack + stack_size - m[i].sp);
+  }
+  return(q - p);
+}
+
+
+void restore_link(char *p)
+{
+/* Put back the state of the link that save_link() copied to p. */
+
+  int i, n;
+
+  for (i = 0; i < 2; i++) {
+	p = get(p, &m[i].jb, JB_SIZE);
+	p = get(p, &m[i].status, sizeof(int));
+	p = get(p, &m[i].sp, sizeof(char *));
+	p = get(p, &m[i].frames, sizeof(char *));
+	p = get(p, &n, sizeof(int));
+	if (m[i].size < n) {
+		m[i].size = n + PIPE_START;
+		m[i].pipe = (frame *) realloc(m[i].pipe, m[i].size*sizeof(frame));
+		if (m[i].pipe == NULL) sim_error("Out of memory for pipe");
+	}
+	p = get(p, m[i].pipe, n * sizeof(frame));
+	m[i].head = 0;
+	m[i].tail = n;
+	m[i].started = 1;
+	load_worker(i);
+	p += load_model(p);
+	p = get(p, m[i].sp, m[i].stack + stack_size - m[i].sp);
+  }
+}
+
+
+bigint hash_link(void)
+{
+/* A hash of the state of the link, by which explore.c tells states apart. */
+
+  int i;
+  bigint h = 0;
+
+  for (i = 0; i < 2; i++) {
+	load_worker(i);
+	h = hash_worker(h);
+	h = hash_more(h, m[i].frames, m[i].stack + stack_size - m[i].frames);
+	h = hash_more(h, (char *) &m[i].pipe[m[i].head],
+				(m[i].tail - m[i].head) * sizeof(frame));
+	h = hash_more(h, (char *) &m[i].status, sizeof(int));
+  }
+  return(h);
+}
+
+
+static char *put(char *q, void *x, int n)
+{
+/* Copy n bytes of x to q and return where the next ones go. */
+
+  memcpy(q, x, n);
+  return(q + n);
+}
+
+
+static char *get(char *p, void *x, int n)
+{
+/* Copy n bytes from p to x and return where the next ones are. */
+
+  memcpy(x, p, n);
+  return(p + n);
+}
+
+
+static char *stack_pointer(void)
+{
+/* The stack pointer of the caller at the call: above this function's frame
+ * pointer are the saved one and the return address.  That is the layout of
+ * x86-64; elsewhere the result may be a little low, which only means some
+ * dead bytes are taken for part of the state.
+ */
+
+  return((char *) __builtin_frame_address(0) + 2 * sizeof(void *));
+}
+
+
+static int pick(bigint *rng, bigint *tick, bigint last_tick)
+{
+/* Pick the worker to be given *tick by the policy (-y).  It is one of those
+ * that have something to do by then: a frame in the pipe or an event due.
+ * If neither has, the clock moves on to the first tick at which one does,
+ * unless other connections share the link on a medium (-g); -1 if that
+ * is past the end.  If there is no such tick either, any worker will do,
+ * and main finds out whether the link is deadlocked.
+ */
+
+  int i, ready[2];
+  bigint due, t;
+
+  for (i = 0; i < 2; i++)
+	ready[i] = (m[i].tail > m[i].head || m[i].due <= *tick);
+  if (!ready[0] && !ready[1] && conns == 1 && medium == MED_NONE) {
+	due = (m[0].due < m[1].due ? m[0].due : m[1].due);
+	if (due == NEVER) return(next_random(rng) & 1);
+	t = (due + DELTA - 1) / DELTA * DELTA;	/* ticks are DELTA apart */
+	if (t > last_tick) {
+		*tick = last_tick;
+		return(-1);
+	}
+	*tick = t;
+	for (i = 0; i < 2; i++) ready[i] = (m[i].due <= t);
+  }
+  if (!ready[0] || !ready[1]) {
+	if (!ready[0] && !ready[1]) return(next_random(rng) & 1);
+	last_pick = ready[1];
+	return(last_pick);
+  }
+  switch (policy) {
+    case POL_READY:	last_pick = next_random(rng) & 1;	break;
+    case POL_ROUND:	last_pick = 1 - last_pick;	break;
+    case POL_WEIGHTED:	last_pick = (next_random(rng) % (weight[0] +
+					weight[1]) >= weight[0]);	break;
+  }
+  return(last_pick);
+}
+
+
+static int next_conn(void)
+{
+/* Make the next connection in the rotation that is not stuck the current
+ * one and count the event it is given; 0 if every one is stuck (-g).
+ */
+
+  int c;
+  bigint word[2];
+
+  while (nready > 0) {
+	if (cursor >= nready) cursor = 0;
+	c = ready[cursor];
+	word[0] = pairs[2 * c].word;
+	word[1] = pairs[2 * c + 1].word;
+	if (!quiescent(word)) {
+		cursor++;
+		turns[c]++;
+		m = &pairs[2 * c];
+		return(1);
+	}
+	nready--;		/* out for good; the rest keep their order */
+	memmove(&ready[cursor], &ready[cursor + 1],
+					(nready - cursor) * sizeof(int));
+  }
+  return(0);
+}
+
+
+static void collect_conns(struct result *r)
+{
+/* Sum the statistics of the connections of the link into r, and record the
+ * spread of their goodputs: the payloads a connection accepted, both ways,
+ * per event it was given (-g).
+ */
+
+  int c, i, k, b;
+  bigint s[NSTAT];
+  double gp;
+
+  memset(r->stats, 0, sizeof(r->stats));
+  r->alive[0] = r->alive[1] = 1;
+  r->conns = conns;
+  r->stuck = conns - nready;
+  r->gp_sum = r->gp_sumsq = r->gp_max = 0;
+  r->gp_min = 1e9;
+  memset(r->gp_hist, 0, sizeof(r->gp_hist));
+  for (c = 0; c < conns; c++) {
+	gp = 0;
+	for (i = 0; i < 2; i++) {
+		load_state(pairs[2 * c + i].state);
+		collect_statistics(s);
+		for (k = 0; k < NSTAT; k++) r->stats[i][k] += s[k];
+		if (pairs[2 * c + i].status != RUNNING) r->alive[i] = 0;
+		gp += s[ST_PAYLOADS];
+		release_worker();
+	}
+	gp = (turns[c] > 0 ? gp / turns[c] : 0);
+	r->gp_sum += gp;
+	r->gp_sumsq += gp * gp;
+	if (gp < r->gp_min) r->gp_min = gp;
+	if (gp > r->gp_max) r->gp_max = gp;
+	b = gp * GP_BINS;
+	r->gp_hist[b < GP_BINS ? b : GP_BINS - 1]++;
+  }
+  for (i = 0; i < 2; i++) {	/* these are levels, not counts: average */
+	r->stats[i][ST_RTO] /= conns;
+	r->stats[i][ST_SRTT] /= conns;
+	r->stats[i][ST_DELAY] /= conns;
+  }
+  m = pairs;
+}
+
+
+static void show_goodputs(struct result *res, int n)
+{
+/* Print the spread of the goodputs of the connections of n links (-q, -g),
+ * with Jain's fairness index, (sum x)^2 / (N sum x^2), which is 1 when all
+ * N connections do equally well and 1/N when one does all the work.
+ */
+
+  int l, b, k, got, stuck, total;
+  int hist[GP_BINS];
+  double sum, sumsq, lo, hi, at[3];
+  static double q[3] = {0.1, 0.5, 0.9};
+
+  memset(hist, 0, sizeof(hist));
+  sum = sumsq = hi = 0;
+  lo = 1e9;
+  total = stuck = 0;
+  for (l = 0; l < n; l++) {
+	total += res[l].conns;
+	stuck += res[l].stuck;
+	sum += res[l].gp_sum;
+	sumsq += res[l].gp_sumsq;
+	if (res[l].gp_min < lo) lo = res[l].gp_min;
+	if (res[l].gp_max > hi) hi = res[l].gp_max;
+	for (b = 0; b < GP_BINS; b++) hist[b] += res[l].gp_hist[b];
+  }
+  for (k = 0; k < 3; k++) {	/* the middle of the bin the quantile is in */
+	got = 0;
+	for (b = 0; b < GP_BINS - 1; b++)
+		if ((got += hist[b]) >= q[k] * total) break;
+	at[k] = (b + 0.5) / GP_BINS;
+	if (at[k] < lo) at[k] = lo;
+	if (at[k] > hi) at[k] = hi;
+  }
+  printf("Goodput of %d connections (payloads/event given): mean %.3f  min %.3f  10%% %.3f  median %.3f  90%% %.3f  max %.3f\n",
+	total, sum / total, lo, at[0], at[1], at[2], hi);
+  printf("Fairness (Jain's index) %.4f; %d connections deadlocked\n",
+	sumsq > 0 ? sum * sum / (total * sumsq) : 1.0, stuck);
+}
+
+
+static void progress(bigint c[3])
+{
+/* Sum the counters of both workers, loading each one's globals in turn. */
+
+  int i;
+
+  c[PRG_PAYLOADS] = c[PRG_SENT] = c[PRG_RETRANS] = 0;
+  for (i = 0; i < 2; i++) {
+	if (loaded != &m[i]) {
+		if (loaded != NULL) save_state(loaded->state);
+		load_state(m[i].state);
+		loaded = &m[i];
+	}
+	count_progress(c);
+  }
+}
+
+
+static void snapshot(bigint st[2][NSTAT])
+{
+/* Collect the statistics of both workers, loading their globals in turn. */
+
+  int i;
+
+  for (i = 0; i < 2; i++) {
+	if (loaded != &m[i]) {
+		if (loaded != NULL) save_state(loaded->state);
+		load_state(m[i].state);
+		loaded = &m[i];
+	}
+	collect_statistics(st[i]);
+  }
+}
+
+
+static int mser(int n)
+{
+/* The MSER truncation point of mser_z[0..n-1], or -1 if there is none yet:
+ * too few batches, or the best d is in the second half, so the warm-up
+ * may not be over.  The sums run from the end, so every d costs O(1).
+ */
+
+  int d, best;
+  double s1, s2, k, v, least;
+
+  if (n < MIN_MSER) return(-1);
+  s1 = s2 = 0;
+  best = -1;
+  least = 0;
+  for (d = n - 1; d >= 0; d--) {
+	s1 += mser_z[d];
+	s2 += mser_z[d] * mser_z[d];
+	k = n - d;
+	if (k < MSER_BATCH) continue;	/* too few left to judge */
+	v = (s2 - s1 * s1 / k) / (k * k);
+	if (best < 0 || v <= least) {
+		least = v;
+		best = d;
+	}
+  }
+  return(best >= 0 && best <= n/2 && best <= MAX_MSER/2 ? best : -1);
+}
+
+
+static void cut_warmup(struct result *r, bigint base[2][NSTAT])
+{
+/* Leave the warm-up out of the statistics of r: counts start at base.  The
+ * timeout and round trip time are levels at the end and stay as they are;
+ * the mean delay is of the packets delivered after the warm-up.
+ */
+
+  int i, k;
+  bigint *s, n;
+
+  for (i = 0; i < 2; i++) {
+	s = r->stats[i];
+	n = s[ST_PAYLOADS] - base[i][ST_PAYLOADS];
+	s[ST_DELAY] = (n > 0 ? (s[ST_DELAY] * s[ST_PAYLOADS] -
+		base[i][ST_DELAY] * base[i][ST_PAYLOADS]) / n : 0);
+	for (k = 0; k < NSTAT; k++)
+		if (k != ST_RTO && k != ST_SRTT && k != ST_DELAY)
+			s[k] -= base[i][k];
+  }
+}
+
+
+static int split(bigint *rng, bigint tick)
+{
+/* Fork the copies of the run at a new level, one at a time, waiting for
+ * each to finish.  Return 1 in a copy, 0 in the original.
+ */
+
+  int c, i, fd[2];
+  double sum;
+  bigint paths, events;
+  pid_t pid;
+
+  for (c = 1; c < rare_split; c++) {
+	if (pipe(fd) < 0 || (pid = fork()) < 0) {
+		printf("Cannot split the run\n");
+		exit(1);
+	}
+	if (pid == 0) {
+		close(fd[0]);
+		clone_fd = fd[1];
+		born = tick;
+		rare_sum = 0;
+		rare_paths = rare_events = 0;
+		*rng = mix(*rng + c * 0x9E3779B97F4A7C15UL);
+		for (i = 0; i < 2; i++) {
+			if (loaded != &m[i]) {
+				if (loaded != NULL) save_state(loaded->state);
+				load_state(m[i].state);
+				loaded = &m[i];
+			}
+			reseed_worker(c * 0x9E3779B97F4A7C15UL);
+		}
+		return(1);
+	}
+	close(fd[1]);
+	if (read(fd[0], &sum, sizeof(sum)) == sizeof(sum) &&
+	    read(fd[0], &paths, sizeof(paths)) == sizeof(paths) &&
+	    read(fd[0], &events, sizeof(events)) == sizeof(events)) {
+		rare_sum += sum;
+		rare_paths += paths + 1;
+		rare_events += events;
+	}
+	close(fd[0]);
+	waitpid(pid, (int *) 0, 0);
+  }
+  return(0);
+}
+
+
+static void share(bigint tick)
+{
+/* Publish the statistics of this job's links so far (-m): those of the
+ * finished links plus those of the current one.  Partition j runs the
+ * links l with l % jobs == j.
+ */
+
+  int i, k;
+  bigint st[2][NSTAT];
+
+  snapshot(st);
+  for (i = 0; i < 2; i++)
+	for (k = 0; k < NSTAT; k++) st[i][k] += done[i][k];
+  publish(link_nr % jobs, done_events + tick/DELTA, done_links + 1,
+							done_links, st);
+}
+
+
+bigint batch_ticks(void)
+{
+/* The length of a batch: long compared with a timeout, so that successive
+ * batch means are nearly independent, but at least 1000 events.
+ */
+
+  return(100 * timeout_interval > 1000 * DELTA ? 100 * timeout_interval :
+								1000 * DELTA);
+}
+
+
+int add_batch(struct means *mt, bigint c[3])
+{
+/* A batch has ended; c[] holds the counters so far.  Fold the batch into
+ * the means and tell whether the link may stop.  The first batch is only
+ * a warm-up: the link starts out empty.
+ */
+
+  int i;
+  bigint d[3];
+  double x[2], mean, var, half;
+
+  for (i = 0; i < 3; i++) {
+	d[i] = c[i] - mt->last[i];
+	mt->last[i] = c[i];
+  }
+  if (!mt->warm) {		/* the warm-up is over */
+	mt->warm = 1;
+	return(0);
+  }
+  x[0] = (double) d[PRG_PAYLOADS] / (batch_ticks() / DELTA);
+  x[1] = (d[PRG_SENT] > 0 ? (double) d[PRG_RETRANS] / d[PRG_SENT] : 0);
+  mt->batches++;
+  for (i = 0; i < 2; i++) {
+	mt->sum[i] += x[i];
+	mt->sumsq[i] += x[i] * x[i];
+  }
+  if (mt->batches < MIN_BATCHES) return(0);
+  for (i = 0; i < 2; i++) {
+	mean = mt->sum[i] / mt->batches;
+	var = (mt->sumsq[i] - mt->batches * mean * mean) / (mt->batches - 1);
+	half = t95(mt->batches - 1) * sqrt(var > 0 ? var : 0) / sqrt(mt->batches);
+	if (half > precision * (mean > 0 ? mean : -mean)) return(0);
+  }
+  return(1);
+}
+
+
+void end_means(struct means *mt, struct result *r)
+{
+/* Put the batch means of a link and their confidence intervals in r. */
+
+  int i;
+  double mean, var;
+
+  r->batches = mt->batches;
+  for (i = 0; i < 2; i++) {
+	mean = (mt->batches > 0 ? mt->sum[i] / mt->batches : 0);
+	var = (mt->batches > 1 ? (mt->sumsq[i] - mt->batches * mean * mean)
+						/ (mt->batches - 1) : 0);
+	r->mean[i] = mean;
+	r->half[i] = (mt->batches > 1 ? t95(mt->batches - 1) *
+		sqrt(var > 0 ? var : 0) / sqrt(mt->batches) : 0);
+  }
+}
+
+
+double t95(int df)
+{
+/* The two-sided 95% point of Student's t distribution. */
+
+  static double t[] = {0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+	2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110,
+	2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+	2.048, 2.045, 2.042};
+
+  if (df <= 30) return(t[df]);
+  return(1.960 + 2.4 / df);	/* within 0.002 beyond the table */
+}
+
+
+static void report(struct result *res, bigint last_tick)
+{
+/* Print the results.  A single link is reported exactly the way the fork
+ * engine reports it.  For many links there is one line per link, followed
+ * by the statistics summed over all links.  With -p, also show the batch
+ * means and how many events the links needed, with -w how long the
+ * warm-ups were, with -x the chance of the rare event, estimated from
+ * the links as independent replications, with -q how the goodput was
+ * spread over the connections, and with -g what the medium did.
+ */
+
+  int l, i, k, eff, missed;
+  bigint acc, sent, tot[2][NSTAT], used, most, paths;
+  double mean, var;
+
+  if (links == 1) {
+	for (i = 0; i < 2; i++)
+		if (res->alive[i]) show_statistics(i, res->stats[i]);
+	if (strlen(res->reason) > 0) {
+		acc = res->stats[0][ST_PAYLOADS] + res->stats[1][ST_PAYLOADS];
+		sent = res->stats[0][ST_DATA_SENT]+res->stats[1][ST_DATA_SENT];
+		if (sent > 0) {
+			eff = (100 * acc)/sent;
+			printf("\nEfficiency (payloads accepted/data pkts sent) = %d%c\n", eff, '%');
+		}
+		if (precision > 0) printf("Goodput %.4f +- %.4f payloads/event, retransmitted %.4f +- %.4f (%d batches)\n",
+			res->mean[0], res->half[0], res->mean[1], res->half[1],
+								res->batches);
+		if (warmup && res->warm_found) printf("Warm-up of %lu events left out; goodput after it %.4f payloads/event\n",
+			res->warm/DELTA, res->time > res->warm ?
+			(double) acc / ((res->time - res->warm)/DELTA) : 0);
+		if (warmup && !res->warm_found)
+			printf("End of the warm-up not found; nothing left out\n");
+		if (rare_level > 0) printf("Chance of %d timeouts in a row: %.4g (%lu runs, %lu events)\n",
+			rare_level, res->rare, res->paths, res->rare_events);
+		if (conns > 1) show_goodputs(res, 1);
+		if (medium != MED_NONE) show_medium(res, 1);
+		printf("%s.  Time=%lu\n", res->reason, res->time/DELTA);
+	}
+	return;
+  }
+
+  for (i = 0; i < 2; i++)
+	for (k = 0; k < NSTAT; k++) tot[i][k] = 0;
+  printf("\n");
+  for (l = 0; l < links; l++) {
+	acc = res[l].stats[0][ST_PAYLOADS] + res[l].stats[1][ST_PAYLOADS];
+	sent = res[l].stats[0][ST_DATA_SENT] + res[l].stats[1][ST_DATA_SENT];
+	printf("Link %4d: %s.  Time=%lu  Efficiency=%d%c\n", l,
+		strlen(res[l].reason) > 0 ? res[l].reason : "Worker exited",
+		res[l].time/DELTA, sent > 0 ? (int) ((100 * acc)/sent) : 0, '%');
+	for (i = 0; i < 2; i++)
+		for (k = 0; k < NSTAT; k++) tot[i][k] += res[l].stats[i][k];
+  }
+  for (i = 0; i < 2; i++) {	/* these are levels, not counts: average */
+	tot[i][ST_RTO] /= links;
+	tot[i][ST_SRTT] /= links;
+	tot[i][ST_DELAY] /= links;
+  }
+
+  printf("\nTotals over %d links:\n", links);
+  for (i = 0; i < 2; i++) show_statistics(i, tot[i]);
+  acc = tot[0][ST_PAYLOADS] + tot[1][ST_PAYLOADS];
+  sent = tot[0][ST_DATA_SENT] + tot[1][ST_DATA_SENT];
+  if (sent > 0) {
+	eff = (100 * acc)/sent;
+	printf("\nEfficiency (payloads accepted/data pkts sent) = %d%c\n", eff, '%');
+  }
+  if (conns > 1) show_goodputs(res, links);
+  if (medium != MED_NONE) show_medium(res, links);
+  if (precision > 0) {
+	used = 0;
+	most = 0;
+	for (l = 0; l < links; l++) {
+		used += res[l].time/DELTA;
+		if (res[l].time > most) most = res[l].time;
+	}
+	printf("Events needed: %lu in all, %lu per link on average, %lu at most\n",
+				used, used/links, most/DELTA);
+  }
+  if (warmup) {
+	used = 0;
+	most = 0;
+	missed = 0;
+	for (l = 0; l < links; l++) {
+		if (!res[l].warm_found) missed++;
+		used += res[l].warm/DELTA;
+		if (res[l].warm > most) most = res[l].warm;
+	}
+	printf("Warm-up left out: %lu events per link on average, %lu at most; not found on %d links\n",
+		links > missed ? used/(links - missed) : 0, most/DELTA, missed);
+  }
+  if (rare_level > 0) {
+	mean = var = 0;
+	paths = used = 0;
+	for (l = 0; l < links; l++) {
+		mean += res[l].rare / links;
+		paths += res[l].paths;
+		used += res[l].rare_events;
+	}
+	for (l = 0; l < links; l++)
+		var += (res[l].rare - mean) * (res[l].rare - mean) / (links - 1);
+	printf("Chance of %d timeouts in a row: %.4g +- %.4g (95%%; %lu runs, %lu events)\n",
+		rare_level, mean, t95(links - 1) * sqrt(var / links), paths, used);
+  }
+  printf("End of simulation.  Time=%lu  Links=%d  Processes=%d\n",
+					last_tick/DELTA, links, jobs);
+}
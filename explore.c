@@ -0,0 +1,413 @@
+/* Exhaustive exploration of a protocol (-v P:F).
+ *
+ * A simulation follows one run of a protocol, picked at random, and finds a
+ * bug only if that run happens to hit it; the check in to_network_layer()
+ * for packets delivered out of order is then how it shows.  With -v P:F the
+ * simulator follows every run instead, until P packets have been delivered
+ * each way (one way for protocols 2 and 3), and looks for a state in which
+ * a packet is delivered out of order, or in which nothing can happen any
+ * more although packets are still missing: a deadlock.  If there is one,
+ * the shortest run leading to it is shown with the debug output.
+ *
+ * The workers are the coroutines of the in-process engine.  In any state
+ * either one may run next, and it may handle any event pick_event() could
+ * give it: a frame arriving, the network layer having a packet, a timer
+ * going off.  Time is not kept, so a timer that is running may go off at
+ * any moment, early or not, though timers still go off in the order they
+ * were set.  A frame sent may be lost, if the loss rate is not 0, and a
+ * frame arriving may be damaged, if the checksum error rate is not 0.  The
+ * worker asks choose_way() about each of these things, and the answers it
+ * gets are the script of the step; running the step again from the same
+ * state with the other scripts gives the other states that follow.  A state
+ * with more than F frames on their way in either direction is not followed,
+ * or timeouts could fill the line without end.
+ *
+ * The search is breadth first, one level at a time, so the first bad state
+ * found is as close to the start as any.  The states of the level being
+ * followed and of the next one are kept in full (see save_link() in
+ * engine.c); all states seen are kept only as a 64-bit hash, in a table in
+ * memory shared by the -j jobs, which fork for each level and take states
+ * from it as they go.  A hash covers what a worker will still look at: its
+ * protocol's stack frames, the model's variables and the frames on their
+ * way (see hash_link()).  A dead variable in a protocol's frame may still
+ * tell two equal states apart, which only costs time; two states sharing a
+ * hash, with a chance of about 2^-64 per pair, would hide the second one.
+ */
+
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS and MAP_NORESERVE */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "common.h"
+
+#define MAX_CHOICES 30		/* choices in one step */
+#define MAX_STATES (1L << 24)	/* states numbered */
+#define TABLE_SIZE (1L << 25)	/* slots for hashes; twice MAX_STATES */
+#define ARENA (1L << 30)	/* bytes for the states of one level */
+#define SNAP_MAX (256 * 1024)	/* bytes of one state, at most */
+#define START 2			/* proc of the step that sets the link up */
+#define SHOW 0x0017		/* debug flags for a run found: all but 8 */
+#define BAD_DEADLOCK 1		/* kinds of bad state, the preferred first */
+#define BAD_ORDER 2
+
+struct node {			/* a state, and how it was reached */
+  int parent;			/* the state it was reached from; -1: none */
+  char proc;			/* the worker that ran, or START */
+  char follow;			/* are its successors to be looked at? */
+  unsigned char n;		/* choices made on the way */
+  unsigned char choice[MAX_CHOICES];
+  long at;			/* where it is kept in its level's arena */
+};
+
+static struct shared {		/* shared by the jobs */
+  long nodes;			/* states numbered so far */
+  long next;			/* next state of the level to follow */
+  long used[2];			/* bytes used in the arenas of the levels */
+  long steps;			/* steps taken that led to a state */
+  long cut;			/* states not followed: too many frames */
+  long done;			/* states with all packets delivered */
+  int full;			/* out of room: the search is incomplete */
+  bigint bad;			/* steps << 40 | kind << 32 | state; 0: none */
+} *sh;
+static bigint *table;		/* hashes of the states seen; 0: empty */
+static struct node *node;	/* the states, by number */
+static char *arena[2];		/* even and odd levels */
+static char *snap;		/* where a state is made */
+static int show_flags;		/* debug flags for the run shown */
+
+/* The script of the step being run. */
+static unsigned char want[MAX_CHOICES];	/* the answers to give */
+static unsigned char ways[MAX_CHOICES];	/* how many there were */
+static int calls;		/* questions asked so far */
+static int given;		/* answers in want[] from before the step */
+
+/* Prototypes. */
+static void *shared(long size);
+static void level(long lo, long hi, int depth);
+static void work(long hi, int depth);
+static void follow(long k, int depth);
+static void reached(long parent, int proc, int depth);
+static long add(long parent, int proc);
+static int seen(bigint h);
+static void found(int steps, int kind, long k);
+static int next_script(void);
+static void show_run(long k, int kind);
+
+
+int explore(void)
+{
+/* Search all the states of the link; return 1 if a bad one was found. */
+
+  long lo, hi;
+  int depth;
+
+  sh = shared(sizeof(*sh));
+  table = shared(TABLE_SIZE * sizeof(bigint));
+  node = shared(MAX_STATES * sizeof(struct node));
+  arena[0] = shared(ARENA);
+  arena[1] = shared(ARENA);
+  snap = malloc(SNAP_MAX);
+  if (snap == NULL) {
+	printf("Out of memory\n");
+	exit(1);
+  }
+  init_engine();
+  searching = 1;
+  show_flags = (debug_flags != 0 ? debug_flags : SHOW);
+  debug_flags = 0;		/* quiet until a run is shown */
+
+  /* The workers may already choose while they set up, so even the first
+   * level may hold more than one state.
+   */
+  given = 0;
+  do {
+	calls = 0;
+	begin_link(0);
+	reached(-1, START, 0);
+  } while (next_script());
+
+  lo = 0;
+  for (depth = 0; ; depth++) {
+	hi = sh->nodes;
+	if (lo == hi || sh->bad != 0 || sh->full) break;
+	level(lo, hi, depth);
+	sh->used[depth & 1] = 0;	/* now free for level depth + 2 */
+	lo = hi;
+  }
+
+  printf("Protocol %d, %d packets %s, at most %d frames on the way each way\n",
+	protocol, verify, protocol <= 3 ? "from M0 to M1" : "each way",
+	in_flight);
+  printf("States: %ld  Steps: %ld  Levels: %d  Done: %ld  Cut: %ld\n",
+	sh->nodes, sh->steps, depth, sh->done, sh->cut);
+  if (sh->full) printf("Out of room: not all states were looked at\n");
+  if (sh->bad != 0) {
+	show_run(sh->bad & 0xFFFFFFFF, (sh->bad >> 32) & 0xFF);
+	return(1);
+  }
+  if (!sh->full) printf("No packet is delivered out of order and there is no deadlock\n");
+  return(0);
+}
+
+
+static void *shared(long size)
+{
+/* Memory shared with the jobs forked later; only what is used is taken. */
+
+  void *p;
+
+  p = mmap((void *) 0, size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+	printf("Out of memory\n");
+	exit(1);
+  }
+  return(p);
+}
+
+
+static void level(long lo, long hi, int depth)
+{
+/* Follow states lo to hi - 1, which are depth steps from the start: in
+ * this process, or in jobs processes at once.
+ */
+
+  int j;
+
+  sh->next = lo;
+  if (jobs <= 1) {
+	work(hi, depth);
+	return;
+  }
+  for (j = 0; j < jobs; j++) {
+	if (fork() == 0) {
+		work(hi, depth);
+		_exit(0);
+	}
+  }
+  while (wait((int *) 0) > 0) ;
+}
+
+
+static void work(long hi, int depth)
+{
+/* Follow the states of the level no other job has taken yet. */
+
+  long k;
+
+  while ((k = __sync_fetch_and_add(&sh->next, 1)) < hi)
+	if (node[k].follow) follow(k, depth);
+}
+
+
+static void follow(long k, int depth)
+{
+/* Take every step there is from state k.  If neither worker can do
+ * anything, k is a deadlock: it would not be followed if all packets had
+ * been delivered.
+ */
+
+  int proc, idle = 0;
+
+  for (proc = 0; proc < 2; proc++) {
+	given = 0;
+	do {
+		restore_link(arena[depth & 1] + node[k].at);
+		calls = 0;
+		if (!step_link(proc, DELTA)) {	/* it gave up */
+			found(depth + 1, BAD_ORDER, add(k, proc));
+			continue;
+		}
+		if (calls == 0) {	/* nothing for it to do */
+			idle++;
+			break;
+		}
+		reached(k, proc, depth + 1);
+	} while (next_script());
+  }
+  if (idle == 2) found(depth, BAD_DEADLOCK, k);
+}
+
+
+static void reached(long parent, int proc, int depth)
+{
+/* The step just run from parent led to a state; number it and keep it
+ * for the next level, if it is new.
+ */
+
+  long k, at;
+  int n;
+
+  if (link_flight(0) > in_flight || link_flight(1) > in_flight) {
+	__sync_fetch_and_add(&sh->cut, 1);
+	return;
+  }
+  __sync_fetch_and_add(&sh->steps, 1);
+  if (seen(hash_link()) || (k = add(parent, proc)) < 0) return;
+  if (link_delivered(1) >= verify &&
+			(protocol <= 3 || link_delivered(0) >= verify)) {
+	__sync_fetch_and_add(&sh->done, 1);
+	return;
+  }
+  n = save_link(snap);
+  at = __sync_fetch_and_add(&sh->used[depth & 1], n);
+  if (n > SNAP_MAX || at + n > ARENA) {
+	sh->full = 1;
+	return;
+  }
+  memcpy(arena[depth & 1] + at, snap, n);
+  node[k].at = at;
+  node[k].follow = 1;
+}
+
+
+static long add(long parent, int proc)
+{
+/* Number the state the step just run from parent led to; -1 if there is
+ * no room.
+ */
+
+  long k;
+
+  k = __sync_fetch_and_add(&sh->nodes, 1);
+  if (k >= MAX_STATES) {
+	sh->full = 1;
+	return(-1);
+  }
+  node[k].parent = parent;
+  node[k].proc = proc;
+  node[k].follow = 0;
+  node[k].n = calls;
+  memcpy(node[k].choice, want, calls);
+  return(k);
+}
+
+
+static int seen(bigint h)
+{
+/* Put hash h in the table, unless it is there already; then return 1. */
+
+  bigint i, old;
+
+  if (h == 0) h = 1;		/* 0 is an empty slot */
+  for (i = h & (TABLE_SIZE - 1); ; i = (i + 1) & (TABLE_SIZE - 1)) {
+	old = table[i];
+	if (old == 0) {
+		old = __sync_val_compare_and_swap(&table[i], 0, h);
+		if (old == 0) return(0);
+	}
+	if (old == h) return(1);
+  }
+}
+
+
+static void found(int steps, int kind, long k)
+{
+/* State k, steps from the start, is bad.  Keep the shortest one found. */
+
+  bigint old, now;
+
+  if (k < 0) return;
+  now = (bigint) steps << 40 | (bigint) kind << 32 | k;
+  do {
+	old = sh->bad;
+	if (old != 0 && old <= now) return;
+  } while (!__sync_bool_compare_and_swap(&sh->bad, old, now));
+}
+
+
+int choose_way(int n)
+{
+/* A worker asks which of n ways something goes, 0 to n - 1.  The script
+ * says; past its end, the answer is 0.
+ */
+
+  int k;
+
+  if (calls == MAX_CHOICES) {
+	sh->full = 1;		/* cannot follow this step further */
+	return(0);
+  }
+  k = (calls < given ? want[calls] : 0);
+  want[calls] = k;
+  ways[calls++] = n;
+  return(k);
+}
+
+
+static int next_script(void)
+{
+/* Move on to the next script of the step just run: the last answer that
+ * has a way left takes it, and the ones after it go back to 0 (by being
+ * left out).  Return 0 when all of them have been run.
+ */
+
+  int j;
+
+  for (j = calls - 1; j >= 0 && want[j] + 1 >= ways[j]; j--) ;
+  if (j < 0) return(0);
+  want[j]++;
+  given = j + 1;
+  return(1);
+}
+
+
+bigint hash_more(bigint h, char *p, int n)
+{
+/* Add n bytes at p to hash h, 8 at a time. */
+
+  bigint w;
+
+  for (; n >= 8; n -= 8, p += 8) {
+	memcpy(&w, p, 8);
+	h = mix(h ^ w);
+  }
+  if (n > 0) {
+	w = 0;
+	memcpy(&w, p, n);
+	h = mix(h ^ w ^ (bigint) n << 56);
+  }
+  return(h);
+}
+
+
+static void show_run(long k, int kind)
+{
+/* Run the steps from the start to bad state k again, this time with the
+ * debug output on; a step is one event, at tick 1, 2, ...
+ */
+
+  long *path, j;
+  int n = 0, i;
+
+  for (j = k; j >= 0; j = node[j].parent) n++;
+  path = malloc(n * sizeof(long));
+  for (j = k, i = n; j >= 0; j = node[j].parent) path[--i] = j;
+  printf("Shortest run to %s, %d step%s:\n",
+	kind == BAD_DEADLOCK ? "a deadlock" : "a protocol error", n - 1,
+	n == 2 ? "" : "s");
+  searching = 0;
+  debug_flags = show_flags;
+  for (i = 0; i < n; i++) {
+	j = path[i];
+	memcpy(want, node[j].choice, node[j].n);
+	given = node[j].n;
+	calls = 0;
+	if (node[j].proc == START)
+		begin_link(0);
+	else
+		step_link(node[j].proc, i * DELTA);
+  }
+  if (kind == BAD_DEADLOCK) {
+	printf("A deadlock has been detected\n");
+	for (i = 0; i < 2; i++) {
+		load_worker(i);
+		show_window();
+	}
+  }
+  free(path);
+}
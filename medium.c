@@ -0,0 +1,318 @@
+/* Shared medium (-g).
+ *
+ * Every other channel in the simulator is a pair of pipes between M0 and
+ * M1.  With -g N:aloha or -g N:csma, N stations share one broadcast medium
+ * instead.  The link carries N/2 connections, each a pair of stations
+ * running the protocol, and every frame a station sends holds the medium
+ * for air events (-g N:mode:air; 4 if not given).  A frame that
+ * overlaps another one on the medium, by as little as a tick, is garbled:
+ * it still arrives, when its last bit is off the air, but as a cksum_err.
+ * The medium marks it by xoring COLLIDED into its checksum, which a real
+ * CRC (-k) then finds wrong like any other damage.
+ *
+ * A station sends its own frames one after the other, so a frame waits
+ * until the station's last one is off the air.  Under ALOHA it then goes on
+ * the air at once.  Under CSMA the station listens first; if it hears the
+ * medium busy it waits until the medium is idle, then 0 to air - 1 events
+ * more at random, and listens again.  A frame is heard from one event after
+ * it starts, so stations that start within an event of each other still
+ * collide.
+ *
+ * All frames are the same size, and they go on the air in the order of
+ * time, so the frames on the air, kept in a ring in the order they started,
+ * are also in the order they end.  That ordering is all the interval
+ * structure that is needed: the frames a new one overlaps, and the ones a
+ * station can hear, are those at the tail that end after it starts, and the
+ * ones to be delivered are at the head.  Stations with a frame waiting are
+ * kept in a heap by the tick they try next.  So the work of an event goes
+ * with the frames that start, end or collide, not with the stations.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "common.h"
+
+#define COLLIDED 0x5A5A5A5A	/* xored into the checksum of a garbled frame */
+#define HEARD DELTA		/* how long after it starts a frame is heard */
+#define RING_START 64		/* initial size of the ring */
+
+struct on_air {			/* a frame on the medium */
+  frame f;
+  int from;			/* station that sent it */
+  int hit;			/* has it collided? */
+  bigint start;			/* tick it went on the air */
+};
+
+struct waiting {		/* a frame a station has yet to send */
+  frame f;
+  struct waiting *next;
+};
+
+static struct on_air *ring;	/* frames on the air, the oldest at head */
+static int head, count, size;
+static struct waiting **first;	/* each station's frames to send, in order */
+static struct waiting **last;
+static struct waiting *spare;	/* ones not in use */
+static bigint *free_at;		/* when a station's last frame is off the air */
+static bigint *try_at;		/* when a station with a frame waiting tries */
+static int *heap, nheap;	/* those stations, the soonest first */
+static int room;		/* stations there is room for */
+static bigint span;		/* ticks a frame takes on the air */
+static bigint rng;		/* backoffs (CSMA) */
+static bigint sent, good, collided, deferred;
+
+/* Prototypes. */
+static void try_send(int i, bigint t);
+static void go_on_air(int i, bigint t);
+static bigint busy_until(bigint t);
+static void push(int i, bigint at);
+static int pop(void);
+static int sooner(int a, int b);
+
+
+void start_medium(int l)
+{
+/* Make the medium of link l idle, with nothing waiting.  The room made for
+ * an earlier run is kept if it is big enough (see serve.c).
+ */
+
+  int i;
+  struct waiting *w;
+
+  if (stations > room) {
+	free(first);
+	free(last);
+	free(free_at);
+	free(try_at);
+	free(heap);
+	room = stations;
+	first = (struct waiting **) calloc(room, sizeof(struct waiting *));
+	last = (struct waiting **) calloc(room, sizeof(struct waiting *));
+	free_at = (bigint *) calloc(room, sizeof(bigint));
+	try_at = (bigint *) calloc(room, sizeof(bigint));
+	heap = (int *) calloc(room, sizeof(int));
+	if (first == NULL || last == NULL || free_at == NULL ||
+					try_at == NULL || heap == NULL) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+  }
+  for (i = 0; i < stations; i++) {
+	while ((w = first[i]) != NULL) {	/* left over from the last link */
+		first[i] = w->next;
+		w->next = spare;
+		spare = w;
+	}
+	last[i] = NULL;
+	free_at[i] = 0;
+  }
+  head = count = nheap = 0;
+  span = DELTA * (bigint) air;
+  rng = mix(~stream_seed(l, 2));	/* main's seed, hashed otherwise */
+  sent = good = collided = deferred = 0;
+}
+
+
+void medium_send(int i, bigint now, frame *f)
+{
+/* Station i sends frame f at tick now.  It goes on the air at once if the
+ * station is free to send it, or else waits behind the station's others.
+ */
+
+  struct waiting *w;
+
+  if ((w = spare) != NULL) spare = w->next;
+  else if ((w = (struct waiting *) malloc(sizeof(*w))) == NULL)
+	sim_error("Out of memory for the medium");
+  w->f = *f;
+  w->next = NULL;
+  if (first[i] != NULL) {
+	last[i]->next = w;	/* it will be tried when its turn comes */
+	last[i] = w;
+	return;
+  }
+  first[i] = last[i] = w;
+  try_send(i, now);
+}
+
+
+void medium_step(bigint now)
+{
+/* Move the medium on to tick now: deliver the frames that are off the air
+ * by then, and let the stations whose turn it is try to send.
+ */
+
+  frame f;
+  struct on_air *a;
+
+  while (count > 0 && ring[head].start + span <= now) {
+	a = &ring[head];
+	f = a->f;
+	if (a->hit) f.cksum ^= COLLIDED;
+	else good++;
+	engine_deliver(a->from ^ 1, &f);	/* to the station's peer */
+	head = (head + 1) % size;
+	count--;
+  }
+  while (nheap > 0 && try_at[heap[0]] <= now) try_send(pop(), now);
+}
+
+
+static void try_send(int i, bigint t)
+{
+/* Station i tries to put its first frame on the air at tick t. */
+
+  bigint b;
+
+  if (free_at[i] > t) {		/* still sending the last one */
+	push(i, free_at[i]);
+	return;
+  }
+  if (medium == MED_CSMA && (b = busy_until(t)) > t) {
+	deferred++;
+	push(i, b + DELTA * (next_random(&rng) % air));
+	return;
+  }
+  go_on_air(i, t);
+  if (first[i] != NULL) push(i, free_at[i]);
+}
+
+
+static void go_on_air(int i, bigint t)
+{
+/* Put the first frame of station i on the air at tick t, and mark it and
+ * every frame it overlaps as collided.
+ */
+
+  int k, n, hit = 0;
+  struct waiting *w;
+  struct on_air *grown;
+
+  if (count == size) {		/* full: unroll the ring into a bigger one */
+	n = (size == 0 ? RING_START : 2 * size);
+	grown = (struct on_air *) malloc(n * sizeof(struct on_air));
+	if (grown == NULL) sim_error("Out of memory for the medium");
+	for (k = 0; k < count; k++) grown[k] = ring[(head + k) % size];
+	free(ring);
+	ring = grown;
+	size = n;
+	head = 0;
+  }
+  for (k = count - 1; k >= 0; k--) {	/* the newest ones end last */
+	n = (head + k) % size;
+	if (ring[n].start + span <= t) break;
+	if (!ring[n].hit) collided++;
+	ring[n].hit = 1;
+	hit = 1;
+  }
+  if (hit) collided++;
+  w = first[i];
+  first[i] = w->next;
+  n = (head + count++) % size;
+  ring[n].f = w->f;
+  ring[n].from = i;
+  ring[n].hit = hit;
+  ring[n].start = t;
+  w->next = spare;
+  spare = w;
+  free_at[i] = t + span;
+  sent++;
+}
+
+
+static bigint busy_until(bigint t)
+{
+/* When the medium will be idle as far as a station listening at tick t can
+ * tell: the end of the last frame it hears, or t if it hears none.
+ */
+
+  int k, n;
+
+  for (k = count - 1; k >= 0; k--) {
+	n = (head + k) % size;
+	if (ring[n].start + span <= t) break;
+	if (ring[n].start + HEARD <= t) return(ring[n].start + span);
+  }
+  return(t);
+}
+
+
+static void push(int i, bigint at)
+{
+/* Put station i in the heap, to try again at tick at. */
+
+  int k, up;
+
+  try_at[i] = at;
+  for (k = nheap++; k > 0; k = up) {
+	up = (k - 1) / 2;
+	if (!sooner(i, heap[up])) break;
+	heap[k] = heap[up];
+  }
+  heap[k] = i;
+}
+
+
+static int pop(void)
+{
+/* Take the station that tries first out of the heap. */
+
+  int k, c, i, top = heap[0];
+
+  i = heap[--nheap];
+  for (k = 0; (c = 2 * k + 1) < nheap; k = c) {
+	if (c + 1 < nheap && sooner(heap[c + 1], heap[c])) c++;
+	if (!sooner(heap[c], i)) break;
+	heap[k] = heap[c];
+  }
+  heap[k] = i;
+  return(top);
+}
+
+
+static int sooner(int a, int b)
+{
+/* Does station a try before station b?  Ties go to the lower number. */
+
+  return(try_at[a] < try_at[b] || (try_at[a] == try_at[b] && a < b));
+}
+
+
+void end_medium(struct result *r)
+{
+/* Record what happened on the medium of the link that just ended. */
+
+  r->on_air = sent;
+  r->carried = good;
+  r->collided = collided;
+  r->deferred = deferred;
+}
+
+
+void show_medium(struct result *res, int n)
+{
+/* Print what happened on the medium of n links: the frames that went on
+ * the air, and the load they made and the medium carried, in frames per
+ * frame time.  Under ALOHA the carried load is about G exp(-2G) for an
+ * offered load of G.
+ */
+
+  int l;
+  bigint on = 0, ok = 0, hit = 0, waits = 0, events = 0;
+
+  for (l = 0; l < n; l++) {
+	on += res[l].on_air;
+	ok += res[l].carried;
+	hit += res[l].collided;
+	waits += res[l].deferred;
+	events += (res[l].time - first_tick)/DELTA;
+  }
+  printf("Medium (%s, %d stations, %d events a frame): %lu frames on the air, %lu collided (%.1f%%)",
+	medium == MED_ALOHA ? "ALOHA" : "CSMA", stations, air, on, hit,
+					on > 0 ? 100.0 * hit / on : 0.0);
+  if (medium == MED_CSMA) printf(", %lu deferrals", waits);
+  printf("\nLoad %.3f, carried %.3f (frames per frame time)\n",
+	events > 0 ? (double) on * air / events : 0.0,
+	events > 0 ? (double) ok * air / events : 0.0);
+}
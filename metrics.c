@@ -0,0 +1,269 @@
+/* Live metrics of a run in progress (-m).
+ *
+ * The workers of a run publish their statistics every PUBLISH events into
+ * slots of a shared memory segment, and a server process started before
+ * anything else reads the slots and serves them in the Prometheus text
+ * format, over HTTP, on a loopback TCP port or on a Unix domain socket:
+ *
+ *	sim -m 9100 ...		curl http://127.0.0.1:9100/metrics
+ *	sim -m /tmp/sim.sock ...	curl --unix-socket /tmp/sim.sock http://x/
+ *
+ * Every slot has one writer.  In the fork engine M0 and M1 each have one
+ * and main, which knows the time, has a third; in the other engines every
+ * job has one for all its links.  A slot is guarded by a sequence number
+ * that is odd while the writer is changing it (a seqlock): the writer never
+ * waits, and the server copies the slot again if the number changed under
+ * it, so scraping never holds up the simulation.
+ */
+
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "common.h"
+
+#define MAX_SLOTS 1024		/* publishers: 3, or one per job */
+#define REPLY_SIZE 8192		/* big enough for all the metrics */
+
+struct slot {			/* what one publisher last said */
+  volatile bigint seq;		/* odd while being written */
+  bigint events;		/* events simulated so far */
+  int links;			/* links the gauges below are summed over */
+  int done;			/* links finished */
+  bigint st[2][NSTAT];		/* statistics of M0 and M1, as printed */
+};
+
+static struct slot *slot;	/* nslots of them, in shared memory */
+static int nslots;
+static bigint planned;		/* events the whole run is to take */
+static pid_t server;		/* the server process */
+static pid_t owner;		/* the process that started it */
+
+/* Names of the statistics, in the order of collect_statistics().  Those
+ * ending in _events are levels, which are averaged over links, not added.
+ */
+static char *metric[NSTAT] = {
+  "data_frames_sent_total", "data_frames_lost_total",
+  "data_frames_not_lost_total", "frames_retransmitted_total",
+  "good_acks_received_total", "bad_acks_received_total",
+  "good_data_received_total", "bad_data_received_total",
+  "payloads_accepted_total", "ack_frames_sent_total", "ack_frames_lost_total",
+  "ack_frames_not_lost_total", "timeouts_total", "ack_timeouts_total",
+  "nak_frames_sent_total", "timeout_in_use_events", "smoothed_rtt_events",
+  "packets_offered_total", "mean_packet_delay_events",
+  "undetected_errors_total", "bit_errors_total"
+};
+
+/* Prototypes. */
+static int listen_at(char *where);
+static void serve(int fd, double start);
+static int scrape(char *out, double start);
+static double now(void);
+
+
+void start_metrics(int n, bigint last_tick)
+{
+/* Make n slots and fork off the server.  It must be called before the
+ * workers are forked, so they share the slots, and before any pipes are
+ * made, so the server does not hold their ends open.  The server is
+ * stopped however the caller exits.
+ */
+
+  int fd;
+  pid_t parent = getpid();
+  double start = now();
+
+  nslots = (n < MAX_SLOTS ? n : MAX_SLOTS);
+  planned = (last_tick / DELTA) * links;
+  slot = (struct slot *) mmap((void *) 0, nslots * sizeof(struct slot),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (slot == MAP_FAILED) {
+	printf("Cannot make room for metrics\n");
+	exit(1);
+  }
+  memset(slot, 0, nslots * sizeof(struct slot));
+  if ((fd = listen_at(metrics_at)) < 0) exit(1);
+  if ((server = fork()) == 0) {
+	while (getppid() == parent) serve(fd, start);
+	exit(0);
+  }
+  close(fd);
+  owner = parent;
+  atexit(stop_metrics);
+}
+
+
+void stop_metrics(void)
+{
+/* Stop the server, which otherwise lasts as long as its parent.  Children
+ * inherit the exit handler, so only the process that started it does so.
+ */
+
+  if (server > 0 && getpid() == owner) kill(server, SIGTERM);
+  server = 0;
+}
+
+
+void publish(int k, bigint events, int nlinks, int done, bigint st[2][NSTAT])
+{
+/* Replace what slot k says.  St may be 0 if the publisher keeps none. */
+
+  struct slot *sp;
+
+  if (slot == NULL || k >= nslots) return;
+  sp = &slot[k];
+  sp->seq++;			/* odd: the server keeps off */
+  __sync_synchronize();
+  sp->events = events;
+  sp->links = nlinks;
+  sp->done = done;
+  if (st != NULL) memcpy(sp->st, st, sizeof(sp->st));
+  __sync_synchronize();
+  sp->seq++;
+}
+
+
+static int listen_at(char *where)
+{
+/* Set up the socket the server listens on: a TCP port on the loopback
+ * interface if where is a number, else a Unix domain socket of that name.
+ */
+
+  int fd, on = 1;
+  struct sockaddr_in in;
+  struct sockaddr_un un;
+  struct stat sb;
+
+  if (strspn(where, "0123456789") == strlen(where)) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&in, 0, sizeof(in));
+	in.sin_family = AF_INET;
+	in.sin_port = htons(atoi(where));
+	in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (fd < 0 || bind(fd, (struct sockaddr *) &in, sizeof(in)) < 0) {
+		printf("Cannot serve metrics on port %s\n", where);
+		return(-1);
+	}
+  } else {
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strncpy(un.sun_path, where, sizeof(un.sun_path) - 1);
+	if (lstat(where, &sb) == 0) {	/* left over from an earlier run? */
+		if (!S_ISSOCK(sb.st_mode)) {
+			printf("Will not serve metrics on %s: it is not a socket\n", where);
+			return(-1);
+		}
+		unlink(where);
+	}
+	if (fd < 0 || bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0) {
+		printf("Cannot serve metrics on %s\n", where);
+		return(-1);
+	}
+  }
+  listen(fd, 8);
+  return(fd);
+}
+
+
+static void serve(int fd, double start)
+{
+/* Answer one request, if one comes within a second.  The request itself
+ * is not looked at: whatever the path, the answer is the metrics.
+ */
+
+  int c, n;
+  char req[1024], out[REPLY_SIZE];
+  struct pollfd p;
+
+  p.fd = fd;
+  p.events = POLLIN;
+  if (poll(&p, 1, 1000) <= 0) return;	/* so a dead parent is noticed */
+  if ((c = accept(fd, (struct sockaddr *) 0, (socklen_t *) 0)) < 0) return;
+  p.fd = c;
+  if (poll(&p, 1, 1000) > 0) read(c, req, sizeof(req));
+  n = sprintf(out, "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n\r\n");
+  n += scrape(out + n, start);
+  write(c, out, n);
+  close(c);
+}
+
+
+static int scrape(char *out, double start)
+{
+/* Copy every slot, add them up and print the sums into out. */
+
+  int i, k, e, n, nlinks, done;
+  bigint seq, events, st[2][NSTAT];
+  struct slot copy;
+  double secs, rate;
+
+  events = 0;
+  nlinks = done = 0;
+  memset(st, 0, sizeof(st));
+  for (i = 0; i < nslots; i++) {
+	do {
+		while ((seq = slot[i].seq) & 1) ;	/* being written */
+		__sync_synchronize();
+		memcpy(&copy, (void *) &slot[i], sizeof(copy));
+		__sync_synchronize();
+	} while (slot[i].seq != seq);
+	events += copy.events;
+	nlinks += copy.links;
+	done += copy.done;
+	for (e = 0; e < 2; e++)
+		for (k = 0; k < NSTAT; k++) st[e][k] += copy.st[e][k];
+  }
+  secs = now() - start;
+  rate = (secs > 0 ? events / secs : 0);
+
+  n = sprintf(out, "# TYPE sim_events_total counter\n"
+		"sim_events_total %lu\n", events);
+  n += sprintf(out + n, "# TYPE sim_events_planned gauge\n"
+		"sim_events_planned %lu\n", planned);
+  n += sprintf(out + n, "# TYPE sim_events_per_second gauge\n"
+		"sim_events_per_second %.1f\n", rate);
+  n += sprintf(out + n, "# TYPE sim_eta_seconds gauge\n"
+		"sim_eta_seconds %.1f\n",
+		rate > 0 && planned > events ? (planned - events) / rate : 0);
+  n += sprintf(out + n, "# TYPE sim_links_done gauge\n"
+		"sim_links_done %d\n", done);
+  for (k = 0; k < NSTAT; k++) {
+	if (k == ST_NAKS_SENT && protocol != 6) continue;
+	if ((k == ST_RTO || k == ST_SRTT) && !adaptive) continue;
+	if ((k == ST_OFFERED || k == ST_DELAY) && !sources) continue;
+	if (k == ST_UNDETECTED && checksum == NO_CRC) continue;
+	if (k == ST_BIT_ERRORS && ber == 0) continue;
+	n += sprintf(out + n, "# TYPE sim_%s %s\n", metric[k],
+			strstr(metric[k], "_total") ? "counter" : "gauge");
+	for (e = 0; e < 2; e++)
+		n += sprintf(out + n, "sim_%s{worker=\"%d\"} %lu\n", metric[k],
+			e, strstr(metric[k], "_total") || nlinks == 0 ?
+					st[e][k] : st[e][k] / nlinks);
+  }
+  return(n);
+}
+
+
+static double now(void)
+{
+/* Seconds since the epoch. */
+
+  struct timeval tv;
+
+  gettimeofday(&tv, (struct timezone *) 0);
+  return(tv.tv_sec + tv.tv_usec / 1e6);
+}
@@ -0,0 +1,889 @@
+/* Multiplexing engine for protocols 5 and 6 (-q conns).
+ *
+ * With -q a link carries conns connections instead of one.  M0 and M1 are
+ * then stations, each holding one end of every connection, and between
+ * them is still one pipe each way: every frame is marked with its
+ * connection (conn in the frame), and the station it comes to hands it to
+ * that connection's end.  So the frames of all the connections wait behind
+ * one another on the line, and what is lost or damaged on the way is drawn
+ * from the station's random number stream, as a worker's is on a link of
+ * its own.
+ *
+ * Main picks the station to run the way pick() in engine.c does under -y:
+ * one that has a frame in its pipe or an end with an event due; if neither
+ * has, the clock moves on to when one will.  The station then gives the
+ * event to one of its ends.  A frame it has seen comes first, as in
+ * pick_event(), and goes to the end it is for (only an ack timeout of that
+ * end goes before it); otherwise the ends with an event due take turns,
+ * round robin.  They wait for their turn in a ring, and ends with nothing
+ * to do until a timer goes off wait in a heap by the tick it goes off, so a
+ * step costs about the same for 10 connections as for 10,000.  With one
+ * connection a run is step for step the one the in-process engine does
+ * under -y ready.
+ *
+ * Protocols 5 and 6 are restated here, as in batch.c, together with the
+ * parts of worker.c they use.  An end is a struct end of a few hundred
+ * bytes, not a coroutine with a stack and a copy of the globals of
+ * worker.c, and the connections are one array.  A connection with
+ * MAX_QUEUE frames in a pipe stops the link with "Out of queue space", as
+ * a worker with that many waiting does.  Debug tracing is not supported.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "common.h"
+
+#define MAX_SEQ 7		/* same as in p5.c and p6.c */
+#define NR_BUFS ((MAX_SEQ + 1)/2)	/* protocol 6 */
+#define NT (MAX_SEQ + 1)	/* timers per end */
+#define AUX 2			/* as in worker.c */
+#define RTO_MIN (2 * DELTA)	/* as in worker.c */
+#define RTO_MAX (64 * timeout_interval)
+#define NO_TIMER (~(bigint) 0)	/* what recalc_timers() in worker.c gives */
+#define PIPE_START 64		/* initial ring of a pipe (2^n); it doubles */
+#define HEAP_START 64		/* initial room in a heap; it doubles */
+#define MAX_QUEUE 100000	/* as in worker.c, for each connection */
+#define STUCK (-2)		/* pick_station(): nothing will ever happen */
+#define BYTE 0377		/* as in worker.c */
+
+/* Events. */
+#define NONE	0
+#define FRAME	1
+#define NET	2
+#define TIMEOUT	3
+#define ACKTO	4
+
+/* between() of p5.c and p6.c. */
+#define between(a, b, c) \
+	((((a) <= (b)) && ((b) < (c))) || (((c) < (a)) && ((a) <= (b))) || \
+	 (((b) < (c)) && ((c) < (a))))
+
+/* Statistics, by position in collect_statistics(). */
+#define DATA_SENT 0
+#define DATA_LOST 1
+#define DATA_NOT_LOST 2
+#define DATA_RETRANS 3
+#define GOOD_ACKS 4
+#define BAD_ACKS 5
+#define GOOD_DATA 6
+#define BAD_DATA 7
+#define PAYLOADS 8
+#define ACKS_SENT 9
+#define ACKS_LOST 10
+#define ACKS_NOT_LOST 11
+#define TIMEOUTS 12
+#define ACK_TIMEOUTS 13
+#define NAKS_SENT 14
+#define NCOUNT 15		/* those counted here */
+
+struct end {			/* one end of a connection */
+  bigint timer[NT];		/* frame timers, 0 if not running */
+  bigint sent_at[NT];		/* when the timed frame was sent; 0 if resent */
+  bigint lowest;		/* lowest_timer in worker.c */
+  bigint aux;			/* auxiliary timer (protocol 6) */
+  bigint due;			/* when it next has an event (next_due()) */
+  bigint queued;		/* the due it is in the heap with; 0: none */
+  long srtt, rttvar;		/* as in worker.c, times 8 and 4 */
+  bigint rto;			/* adaptive timeout interval, before backoff */
+  bigint st[NCOUNT];		/* statistics, as in collect_statistics() */
+  unsigned int repeats;		/* timeouts since the last ack */
+  unsigned int seqs[NT];	/* seqs[] of worker.c */
+  unsigned int buf[MAX_SEQ + 1];	/* outbound buffers (6 uses NR_BUFS) */
+  unsigned int in[NR_BUFS];	/* inbound buffers (protocol 6) */
+  unsigned int next_pkt;	/* next_net_pkt */
+  unsigned int last_pkt;	/* last_pkt_given */
+  unsigned int nfs, ae, fe, too_far, nbuf;	/* window edges, nbuffered */
+  unsigned int no_nak, arrived, oldest;	/* protocol 6 */
+  unsigned char net;		/* network layer enabled? */
+  unsigned char listed;		/* in its station's ring? */
+};
+
+struct conn {			/* one connection of the link */
+  struct end end[2];		/* its ends at M0 and M1 */
+  unsigned int flight[2];	/* its frames in the pipes to M0 and M1 */
+  bigint turns;			/* events its ends were given */
+};
+
+struct wake {			/* an end waiting in a heap */
+  bigint at;			/* the due it had when it went in */
+  int c;			/* its connection */
+};
+
+struct station {		/* M0 or M1: one end of every connection */
+  bigint rng;			/* random number stream, as a worker's */
+  frame *pipe;			/* frames on their way to it, in a ring */
+  bigint room;			/* slots in pipe[] (2^n) */
+  bigint head, vis, tail;	/* next out, end of what it has seen, end */
+  int *ring;			/* ends with an event due, in turn */
+  int first, nring;		/* ring[first] is next; nring are in it */
+  struct wake *heap;		/* the others that will have one, soonest first */
+  int nheap, heap_room;
+};
+
+static struct conn *conn;	/* the connections of the link */
+static int room;		/* connections there is room for */
+static struct station station[2];
+static int last_pick;		/* station picked last (-y round) */
+static int alive[2];		/* has no end of M0, of M1, exited? */
+static int full;		/* a connection ran out of queue space */
+
+/* The end taking its turn, as in worker.c. */
+static struct end *s;		/* itself */
+static struct station *sta;	/* its station */
+static int me;			/* 0 or 1 */
+static int cn;			/* its connection */
+static bigint tick;
+static unsigned int offset;	/* prevents two timeouts at the same tick */
+static unsigned int retransmitting;	/* counts retransmissions */
+static unsigned int touched;	/* a timer was started or stopped */
+
+/* Prototypes. */
+static void setup(void);
+static void begin(int l);
+static void run_conns(int l, bigint last_tick, struct result *r);
+static int pick_station(bigint *rng, bigint *t, bigint last_tick);
+static bigint station_due(int e, bigint t);
+static int serve(int e, bigint t);
+static bigint end_due(struct end *en);
+static void place(int e, int c, bigint t);
+static void push(struct station *sp, bigint at, int c);
+static struct wake pop(struct station *sp);
+static void collect(struct result *r);
+
+
+void run_mux(int first, int step, bigint last_tick, struct result *res)
+{
+/* Simulate links first, first + step, first + 2*step, etc., each with
+ * conns connections, and store their results in res[].
+ */
+
+  int l;
+
+  setup();
+  for (l = first; l < links; l += step) run_conns(l, last_tick, &res[l]);
+}
+
+
+static void setup(void)
+{
+/* Make room for the connections.  The server (serve.c) runs one simulation
+ * after another in the same process, so what was made for an earlier one
+ * is kept if it is big enough; pipes and heaps only ever grow.
+ */
+
+  int e;
+  struct station *sp;
+
+  if (conns <= room) return;
+  free(conn);
+  conn = (struct conn *) malloc(conns * sizeof(struct conn));
+  for (e = 0; e < 2; e++) {
+	sp = &station[e];
+	free(sp->ring);
+	sp->ring = (int *) malloc(conns * sizeof(int));
+	if (sp->pipe == NULL) {
+		sp->room = PIPE_START;
+		sp->pipe = (frame *) malloc(sp->room * sizeof(frame));
+		sp->heap_room = HEAP_START;
+		sp->heap = (struct wake *) malloc(sp->heap_room *
+							sizeof(struct wake));
+	}
+	if (sp->ring == NULL || sp->pipe == NULL || sp->heap == NULL)
+		conn = NULL;
+  }
+  if (conn == NULL) {
+	printf("Out of memory for %d connections\n", conns);
+	exit(1);
+  }
+  room = conns;
+}
+
+
+static void begin(int l)
+{
+/* Put every end of link l in the state the protocols are in when they
+ * first call wait_for_event(): each has the network layer enabled, so all
+ * of them are in the ring, in order.
+ */
+
+  int c, e;
+  struct end *en;
+  struct station *sp;
+
+  memset(conn, 0, conns * sizeof(struct conn));
+  for (e = 0; e < 2; e++) {
+	sp = &station[e];
+	sp->rng = stream_seed(l, e);
+	sp->head = sp->vis = sp->tail = 0;
+	sp->first = 0;
+	sp->nring = conns;
+	sp->nheap = 0;
+	for (c = 0; c < conns; c++) {
+		en = &conn[c].end[e];
+		en->net = 1;		/* enable_network_layer() */
+		en->last_pkt = 0xFFFFFFFF;
+		en->too_far = NR_BUFS;
+		en->no_nak = 1;
+		en->oldest = MAX_SEQ + 1;
+		en->rto = timeout_interval;
+		en->listed = 1;
+		sp->ring[c] = c;
+	}
+  }
+  last_pick = 1;		/* so round robin starts with M0 */
+  alive[0] = alive[1] = 1;
+  full = 0;
+}
+
+
+static void run_conns(int l, bigint last_tick, struct result *r)
+{
+/* Simulate link l from start to finish: run_link() in engine.c, with the
+ * stations in place of the workers.
+ */
+
+  int e;
+  bigint t, rng;
+  char *reason;
+  struct means mt;
+
+  begin(l);
+  rng = stream_seed(l, 2);	/* main's stream for this link */
+  t = first_tick;
+  reason = "End of simulation";
+  while (t < last_tick) {
+	t = t + DELTA;
+	if ((e = pick_station(&rng, &t, last_tick)) == -1) break;
+	if (e == STUCK) {
+		reason = "All connections are deadlocked";
+		break;
+	}
+	serve(e, t);
+	if (!alive[0] || !alive[1]) {
+		reason = "";	/* as when main finds a worker's pipe closed */
+		break;
+	}
+	if (full) {
+		reason = "Out of queue space";
+		break;
+	}
+  }
+  memset(&mt, 0, sizeof(mt));
+  r->link = l;
+  r->time = t;
+  strncpy(r->reason, reason, sizeof(r->reason) - 1);
+  r->reason[sizeof(r->reason) - 1] = 0;
+  end_means(&mt, r);
+  collect(r);
+  r->paths = 1;
+  r->rare_events = t/DELTA;
+}
+
+
+static int pick_station(bigint *rng, bigint *t, bigint last_tick)
+{
+/* Pick the station to be given *t, as pick() in engine.c picks a worker:
+ * one that has a frame in its pipe or an event due.  If neither has, the
+ * clock moves on to the first tick at which one does; -1 if that is past
+ * the end, STUCK if there is none.  -y uniform is taken as ready here.
+ */
+
+  int e, ready[2];
+  bigint due, d;
+
+  for (e = 0; e < 2; e++)
+	ready[e] = (station[e].tail > station[e].head ||
+						station_due(e, *t) <= *t);
+  if (!ready[0] && !ready[1]) {
+	due = station_due(0, *t);
+	if ((d = station_due(1, *t)) < due) due = d;
+	if (due == NEVER) return(STUCK);	/* and the pipes are empty */
+	d = (due + DELTA - 1) / DELTA * DELTA;	/* ticks are DELTA apart */
+	if (d > last_tick) {
+		*t = last_tick;
+		return(-1);
+	}
+	*t = d;
+	for (e = 0; e < 2; e++) ready[e] = (station_due(e, d) <= d);
+  }
+  if (!ready[0] || !ready[1]) {
+	last_pick = ready[1];
+	return(last_pick);
+  }
+  switch (policy) {
+    case POL_ROUND:	last_pick = 1 - last_pick;	break;
+    case POL_WEIGHTED:	last_pick = (next_random(rng) % (weight[0] +
+					weight[1]) >= weight[0]);	break;
+    default:		last_pick = next_random(rng) & 1;	break;
+  }
+  return(last_pick);
+}
+
+
+static bigint station_due(int e, bigint t)
+{
+/* The first tick at which station e has something to do, unless a frame
+ * comes first: 0 if it has a frame it has seen or an end with an event due
+ * at t, NEVER if only a frame can wake it (next_due() in worker.c).  Ends
+ * at the front of the ring whose event went away when a frame came for
+ * them out of turn, and heap entries that no longer hold, are cleared out.
+ */
+
+  struct station *sp = &station[e];
+  struct end *en;
+  struct wake w;
+
+  if (sp->head < sp->vis) return(0);
+  while (sp->nring > 0) {
+	en = &conn[sp->ring[sp->first]].end[e];
+	if (en->due <= t) return(0);
+	en->listed = 0;
+	place(e, sp->ring[sp->first], t);
+	sp->first = (sp->first + 1) % conns;
+	sp->nring--;
+  }
+  while (sp->nheap > 0) {
+	en = &conn[sp->heap[0].c].end[e];
+	if (sp->heap[0].at == en->due && !en->listed) return(en->due);
+	w = pop(sp);
+	if (w.at == en->queued) en->queued = 0;
+  }
+  return(NEVER);
+}
+
+
+static bigint end_due(struct end *en)
+{
+/* Next_due() for one end, leaving out frames, which are the station's. */
+
+  bigint t = NEVER;
+
+  if (en->net) return(0);	/* the source is saturated */
+  if (en->lowest != 0 && en->lowest < t) t = en->lowest;
+  if (protocol == 6 && en->aux > 0 && en->aux < t) t = en->aux;
+  return(t);
+}
+
+
+static void place(int e, int c, bigint t)
+{
+/* End c of station e has had its event, or left the ring: put it where it
+ * waits for its next one, at the back of the ring if that is due at t,
+ * else in the heap.  An end in the ring may stay there with its event
+ * gone, until station_due() comes to it.
+ */
+
+  struct station *sp = &station[e];
+  struct end *en = &conn[c].end[e];
+
+  if (en->due <= t) {
+	if (en->listed) return;
+	sp->ring[(sp->first + sp->nring++) % conns] = c;
+	en->listed = 1;
+  } else if (en->due != NEVER && en->due != en->queued) {
+	push(sp, en->due, c);
+	en->queued = en->due;
+  }
+}
+
+
+static void push(struct station *sp, bigint at, int c)
+{
+/* Add end c to the heap of station sp, to be woken at tick at. */
+
+  int i, k;
+
+  if (sp->nheap == sp->heap_room) {
+	sp->heap_room *= 2;
+	sp->heap = (struct wake *) realloc(sp->heap,
+				sp->heap_room * sizeof(struct wake));
+	if (sp->heap == NULL) {
+		printf("Out of memory for the heap of %d connections\n", conns);
+		exit(1);
+	}
+  }
+  for (i = sp->nheap++; i > 0; i = k) {	/* sift up */
+	k = (i - 1) / 2;
+	if (sp->heap[k].at <= at) break;
+	sp->heap[i] = sp->heap[k];
+  }
+  sp->heap[i].at = at;
+  sp->heap[i].c = c;
+}
+
+
+static struct wake pop(struct station *sp)
+{
+/* Take the soonest entry off the heap of station sp. */
+
+  int i, k;
+  struct wake w = sp->heap[0], x = sp->heap[--sp->nheap];
+
+  for (i = 0; (k = 2 * i + 1) < sp->nheap; i = k) {	/* sift down */
+	if (k + 1 < sp->nheap && sp->heap[k + 1].at < sp->heap[k].at) k++;
+	if (x.at <= sp->heap[k].at) break;
+	sp->heap[i] = sp->heap[k];
+  }
+  sp->heap[i] = x;
+  return(w);
+}
+
+
+/* The parts of worker.c the protocols use, for the end taking its turn. */
+
+static void transmit(unsigned int k, unsigned int seq, unsigned int a,
+							unsigned int pkt)
+{
+/* To_physical_layer(): count the frame and, unless it is lost, put it in
+ * the pipe to the other station, marked with its connection.
+ */
+
+  struct station *o = &station[1 - me];
+  frame *f;
+  bigint i;
+
+  if (protocol == 6 && k == data) s->seqs[seq % NR_BUFS] = seq;
+  if (k == data) s->st[DATA_SENT]++;
+  if (k == ack) s->st[ACKS_SENT]++;
+  if (k == nak) s->st[NAKS_SENT]++;
+  if (retransmitting) s->st[DATA_RETRANS]++;
+
+  if ((next_random(&sta->rng) & 01777) < (unsigned int) pkt_loss) {
+	if (k == data) s->st[DATA_LOST]++;
+	if (k == ack) s->st[ACKS_LOST]++;
+	return;
+  }
+  if (k == data) s->st[DATA_NOT_LOST]++;
+  if (k == ack) s->st[ACKS_NOT_LOST]++;
+  if (o->tail - o->head == o->room) {	/* full: double the ring */
+	f = (frame *) malloc(2 * o->room * sizeof(frame));
+	if (f == NULL) {
+		printf("Out of memory for the pipe of %d connections\n", conns);
+		exit(1);
+	}
+	for (i = o->head; i != o->tail; i++)	/* each to the slot its */
+		f[i & (2 * o->room - 1)] = o->pipe[i & (o->room - 1)];
+	free(o->pipe);			/* position selects now */
+	o->pipe = f;
+	o->room *= 2;
+  }
+  f = &o->pipe[o->tail++ & (o->room - 1)];
+  f->kind = k;
+  f->seq = seq;
+  f->ack = a;
+  f->info.data[0] = (pkt >> 24) & BYTE;
+  f->info.data[1] = (pkt >> 16) & BYTE;
+  f->info.data[2] = (pkt >>  8) & BYTE;
+  f->info.data[3] = (pkt      ) & BYTE;
+  f->cksum = 0;
+  f->conn = cn;
+  if (++conn[cn].flight[1 - me] >= MAX_QUEUE) full = 1;
+}
+
+
+static frame *take_frame(int *good)
+{
+/* Frametype(): take the frame at the head of the pipe, which is for this
+ * end, and decide whether it arrived intact.
+ */
+
+  frame *f;
+
+  f = &sta->pipe[sta->head++ & (sta->room - 1)];
+  conn[cn].flight[me]--;
+  *good = ((next_random(&sta->rng) & 01777) >= (unsigned int) garbled);
+  if (f->kind == data) s->st[*good ? GOOD_DATA : BAD_DATA]++;
+  if (f->kind == ack) s->st[*good ? GOOD_ACKS : BAD_ACKS]++;
+  return(f);
+}
+
+
+static unsigned int packet_of(frame *f)
+{
+/* Pktnum(). */
+
+  return((unsigned int) f->info.data[0] << 24 | f->info.data[1] << 16 |
+					f->info.data[2] << 8 | f->info.data[3]);
+}
+
+
+static int deliver(unsigned int pkt)
+{
+/* Returns 0 if the packet is out of order; the end has then exited. */
+
+  if (pkt != s->last_pkt + 1) {
+	printf("Tick %lu. Proc %d of connection %d got protocol error.  Packet delivered out of order.\n", tick/DELTA, me, cn);
+	printf("Expected payload %u but got payload %u\n", s->last_pkt + 1, pkt);
+	alive[me] = 0;
+	return(0);
+  }
+  s->last_pkt = pkt;
+  s->st[PAYLOADS]++;
+  return(1);
+}
+
+
+static void rtt_sample(bigint m)
+{
+  long delta;
+
+  if (s->srtt == 0) {
+	s->srtt = m << 3;
+	s->rttvar = m << 1;
+  } else {
+	delta = (long) m - (s->srtt >> 3);
+	s->srtt += delta;
+	if (delta < 0) delta = -delta;
+	s->rttvar += delta - (s->rttvar >> 2);
+  }
+  s->rto = (s->srtt >> 3) + s->rttvar;
+  if (s->rto < RTO_MIN) s->rto = RTO_MIN;
+  if (s->rto > RTO_MAX) s->rto = RTO_MAX;
+}
+
+
+static bigint timeout_in_use(struct end *en)
+{
+/* As in worker.c: rto, doubled for each repeated timeout. */
+
+  bigint t;
+  unsigned int n;
+
+  if (!adaptive) return(timeout_interval);
+  t = en->rto;
+  for (n = 1; n < en->repeats && t < RTO_MAX; n++) t = 2 * t;
+  return(t < RTO_MAX ? t : RTO_MAX);
+}
+
+
+static void set_timer(unsigned int k)
+{
+  int i;
+
+  if (retransmitting || s->timer[k] != 0) {
+	for (i = 0; i < NT; i++) s->sent_at[i] = 0;
+  } else {
+	s->sent_at[k] = tick;
+  }
+  s->timer[k] = tick + timeout_in_use(s) + offset;
+  offset++;
+  touched = 1;
+}
+
+
+static void clear_timer(unsigned int k)
+{
+  if (s->timer[k] != 0 && s->sent_at[k] != 0)
+	rtt_sample(tick - s->sent_at[k]);
+  s->sent_at[k] = 0;
+  s->repeats = 0;
+  s->timer[k] = 0;
+  touched = 1;
+}
+
+
+static void set_ack_timer(void)
+{
+  s->aux = tick + timeout_interval/AUX;
+  offset++;
+}
+
+
+static void expire_timer(void)
+{
+/* The lowest timer went off: turn it off and count it. */
+
+  int k;
+
+  for (k = 0; k < NT; k++) {
+	if (s->timer[k] == s->lowest) {
+		s->timer[k] = 0;
+		s->oldest = s->seqs[k];
+		touched = 1;
+		break;
+	}
+  }
+  s->st[TIMEOUTS]++;
+  retransmitting = 1;
+  s->repeats++;
+}
+
+
+static void end_turn(unsigned int window)
+{
+/* The end of the protocol's loop body: enable or disable the network layer
+ * and, if a timer was started or stopped, find the lowest one.
+ */
+
+  int k;
+  bigint t;
+
+  s->net = (s->nbuf < window);
+  if (touched) {
+	t = NO_TIMER;
+	for (k = 0; k < NT; k++)
+		if (s->timer[k] > 0 && s->timer[k] < t) t = s->timer[k];
+	s->lowest = t;
+  }
+}
+
+
+/* Protocol 5, one function per event. */
+
+static void send_data5(unsigned int frame_nr, unsigned int frame_expected)
+{
+  transmit(data, frame_nr, (frame_expected + MAX_SEQ) & MAX_SEQ,
+							s->buf[frame_nr]);
+  set_timer(frame_nr);
+}
+
+
+static void frame5(void)
+{
+  int good;
+  frame *r;
+
+  r = take_frame(&good);
+  if (!good) return;		/* cksum_err: just ignore bad frames */
+  if (r->seq == s->fe) {
+	if (!deliver(packet_of(r))) return;
+	inc(s->fe);
+  }
+  while (between(s->ae, r->ack, s->nfs)) {
+	s->nbuf--;
+	clear_timer(s->ae);
+	inc(s->ae);
+  }
+}
+
+
+static void net5(void)
+{
+  s->buf[s->nfs] = s->next_pkt++;
+  s->nbuf++;
+  send_data5(s->nfs, s->fe);
+  inc(s->nfs);
+}
+
+
+static void timeout5(void)
+{
+  unsigned int i;
+
+  expire_timer();
+  s->nfs = s->ae;
+  for (i = 1; i <= s->nbuf; i++) {
+	send_data5(s->nfs, s->fe);
+	inc(s->nfs);
+  }
+}
+
+
+/* Protocol 6, one function per event. */
+
+static void send_frame6(unsigned int fk, unsigned int frame_nr, unsigned int frame_expected)
+{
+  unsigned int info = (fk == data ? s->buf[frame_nr % NR_BUFS] : 0);
+
+  if (fk == nak) s->no_nak = 0;
+  transmit(fk, frame_nr, (frame_expected + MAX_SEQ) & MAX_SEQ, info);
+  if (fk == data) set_timer(frame_nr % NR_BUFS);
+  s->aux = 0;			/* stop_ack_timer() */
+}
+
+
+static void frame6(void)
+{
+  int good;
+  unsigned int seq, nr;
+  frame *r;
+
+  r = take_frame(&good);	/* sending does not touch the pipe it is in */
+  if (!good) {			/* cksum_err */
+	if (s->no_nak) send_frame6(nak, 0, s->fe);
+	return;
+  }
+  seq = r->seq;
+  if (r->kind == data) {
+	if (seq != s->fe && s->no_nak)
+		send_frame6(nak, 0, s->fe);
+	else
+		set_ack_timer();
+	if (between(s->fe, seq, s->too_far) &&
+	    !(s->arrived & (1 << (seq % NR_BUFS)))) {
+		s->arrived |= 1 << (seq % NR_BUFS);
+		s->in[seq % NR_BUFS] = packet_of(r);
+		while (s->arrived & (1 << (s->fe % NR_BUFS))) {
+			if (!deliver(s->in[s->fe % NR_BUFS])) return;
+			s->no_nak = 1;
+			s->arrived &= ~(1 << (s->fe % NR_BUFS));
+			inc(s->fe);
+			inc(s->too_far);
+			set_ack_timer();
+		}
+	}
+  }
+  nr = (r->ack + 1) & MAX_SEQ;
+  if (r->kind == nak && between(s->ae, nr, s->nfs))
+	send_frame6(data, nr, s->fe);
+  while (between(s->ae, r->ack, s->nfs)) {
+	s->nbuf--;
+	clear_timer(s->ae % NR_BUFS);
+	inc(s->ae);
+  }
+}
+
+
+static void net6(void)
+{
+  s->nbuf++;
+  s->buf[s->nfs % NR_BUFS] = s->next_pkt++;
+  send_frame6(data, s->nfs, s->fe);
+  inc(s->nfs);
+}
+
+
+static void timeout6(void)
+{
+  expire_timer();
+  send_frame6(data, s->oldest, s->fe);
+}
+
+
+static void ack_timeout6(void)
+{
+  s->st[ACK_TIMEOUTS]++;
+  send_frame6(ack, 0, s->fe);
+}
+
+
+static int serve(int e, bigint t)
+{
+/* Station e takes its turn at tick t: it picks the end to give an event
+ * to and the event, as wait_for_event() and pick_event() do for a worker,
+ * and then takes in the frames sent to it so far.  0 if it had nothing to
+ * do.
+ */
+
+  int c, ev, seen;
+  struct station *sp = &station[e];
+  struct end *en;
+  struct wake w;
+
+  while (sp->nheap > 0 && sp->heap[0].at <= t) {	/* timers gone off */
+	w = pop(sp);
+	en = &conn[w.c].end[e];
+	if (w.at == en->queued) en->queued = 0;
+	if (w.at == en->due) place(e, w.c, t);
+  }
+  c = -1;
+  seen = (sp->head < sp->vis);
+  if (seen) {
+	c = sp->pipe[sp->head & (sp->room - 1)].conn;
+  } else {
+	while (sp->nring > 0 && c < 0) {
+		c = sp->ring[sp->first];
+		sp->first = (sp->first + 1) % conns;
+		sp->nring--;
+		en = &conn[c].end[e];
+		en->listed = 0;
+		if (en->due > t) {	/* its event went away: not its turn */
+			place(e, c, t);
+			c = -1;
+		}
+	}
+  }
+  if (c < 0) {
+	sp->vis = sp->tail;	/* queue_frames() */
+	return(0);
+  }
+
+  s = &conn[c].end[e];
+  sta = sp;
+  me = e;
+  cn = c;
+  tick = t;
+  offset = 0;
+  retransmitting = 0;
+  touched = 0;
+  ev = NONE;
+  if (protocol == 6 && s->aux > 0 && t >= s->aux) {
+	s->aux = 0;		/* check_ack_timer() */
+	ev = ACKTO;
+  } else if (seen) {
+	ev = FRAME;
+  } else if (s->net) {
+	ev = NET;
+  } else if (s->lowest != 0 && t >= s->lowest) {
+	ev = TIMEOUT;
+  }
+  if (protocol == 5) {
+	switch (ev) {
+	    case FRAME:		frame5();	break;
+	    case NET:		net5();		break;
+	    case TIMEOUT:	timeout5();	break;
+	}
+	if (alive[e]) end_turn(MAX_SEQ);
+  } else {
+	switch (ev) {
+	    case FRAME:		frame6();	break;
+	    case NET:		net6();		break;
+	    case TIMEOUT:	timeout6();	break;
+	    case ACKTO:		ack_timeout6();	break;
+	}
+	if (alive[e]) end_turn(NR_BUFS);
+  }
+  conn[c].turns++;
+  s->due = end_due(s);
+  place(e, c, t);
+  sp->vis = sp->tail;		/* queue_frames() */
+  return(1);
+}
+
+
+static void collect(struct result *r)
+{
+/* Sum the statistics of the connections of the link into r, and record the
+ * spread of their goodputs: the payloads a connection accepted, both ways,
+ * per event its ends were given, as collect_conns() in engine.c does.
+ */
+
+  int c, e, k, b;
+  double gp, rto[2], srtt[2];
+  struct end *en;
+
+  memset(r->stats, 0, sizeof(r->stats));
+  r->alive[0] = alive[0];
+  r->alive[1] = alive[1];
+  r->conns = conns;
+  r->stuck = 0;
+  r->gp_sum = r->gp_sumsq = r->gp_max = 0;
+  r->gp_min = 1e9;
+  memset(r->gp_hist, 0, sizeof(r->gp_hist));
+  rto[0] = rto[1] = srtt[0] = srtt[1] = 0;
+  for (c = 0; c < conns; c++) {
+	gp = 0;
+	for (e = 0; e < 2; e++) {
+		en = &conn[c].end[e];
+		for (k = 0; k < NCOUNT; k++) r->stats[e][k] += en->st[k];
+		rto[e] += timeout_in_use(en)/DELTA;
+		srtt[e] += (en->srtt >> 3)/DELTA;
+		gp += en->st[PAYLOADS];
+	}
+	if (conn[c].end[0].due == NEVER && conn[c].end[1].due == NEVER &&
+			conn[c].flight[0] == 0 && conn[c].flight[1] == 0)
+		r->stuck++;
+	gp = (conn[c].turns > 0 ? gp / conn[c].turns : 0);
+	r->gp_sum += gp;
+	r->gp_sumsq += gp * gp;
+	if (gp < r->gp_min) r->gp_min = gp;
+	if (gp > r->gp_max) r->gp_max = gp;
+	b = gp * GP_BINS;
+	r->gp_hist[b < GP_BINS ? b : GP_BINS - 1]++;
+  }
+  for (e = 0; e < 2; e++) {	/* these are levels, not counts: average */
+	r->stats[e][ST_RTO] = rto[e] / conns;
+	r->stats[e][ST_SRTT] = srtt[e] / conns;
+  }
+}
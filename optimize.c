@@ -0,0 +1,172 @@
+/* Search for the best timeout (-f lo:hi).
+ *
+ * Exercise 4 asks for the timeout interval that gives the highest
+ * efficiency.  A sweep answers it by simulating every timeout from lo to
+ * hi.  With -f lo:hi the simulator instead does a golden-section search on
+ * the timeout: it keeps an interval known to hold the best one, tries two
+ * timeouts inside it that cut it in the golden ratio, throws away the part
+ * beyond the worse of the two, and goes on until the interval is a few
+ * events wide, then tries what is left.  That takes about log(hi - lo) /
+ * log(1.618) tries instead of hi - lo + 1, and it finds the best timeout as
+ * long as efficiency rises to one peak and falls after it, which it does
+ * apart from noise.  With -f lo:hi:delay the mean delay of a packet (which
+ * needs a traffic source, -t or -u) is made as small as possible instead.
+ *
+ * Every timeout tried is simulated on the same links, 0 to links - 1, with
+ * the same random number streams, and with common random numbers (-n) so
+ * the channel loses and damages the same frames whatever the protocol does:
+ * common random numbers between the tries, so the difference between two
+ * timeouts is mostly the timeout itself and little noise.  The links run in
+ * parallel on the -j jobs.  The best timeout is shown with a 95% confidence
+ * interval of its efficiency over the links, and the band of timeouts tried
+ * that are not significantly worse: those whose difference from it, link by
+ * link, has a 95% confidence interval that reaches 0.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include "common.h"
+
+#define PHI 1.6180339887	/* the golden ratio */
+#define ENOUGH 3		/* try all that are left of an interval this wide */
+#define MAX_TRIES 200		/* timeouts tried, at most */
+
+struct try {			/* a timeout tried */
+  int timeout;			/* in events */
+  double *x;			/* the score of every link */
+  double mean, half;		/* their mean and its 95% half width */
+};
+
+static struct try tries[MAX_TRIES];
+static int ntries;
+static struct result *res;	/* results of the links for one timeout */
+
+extern bigint last_tick;	/* when to stop, as parse_args() found (sim.c) */
+
+/* Prototypes. */
+static struct try *attempt(int t);
+static double score(struct result *r);
+static double paired(struct try *a, struct try *b);
+
+
+int optimize(void)
+{
+/* Find the best timeout from opt_lo to opt_hi and print it; 0 if done. */
+
+  int a, b, c, d, t, lo, hi;
+  struct try *best, *tp;
+
+  res = (struct result *) calloc(links, sizeof(struct result));
+  if (res == NULL) {
+	printf("Out of memory\n");
+	return(1);
+  }
+  printf("Looking for the timeout from %d to %d with the %s, on %d links\n",
+	opt_lo, opt_hi, opt_delay ? "least mean delay" : "best efficiency",
+									links);
+
+  /* Narrow [a, b] down, keeping the better of c and d inside it. */
+  a = opt_lo;
+  b = opt_hi;
+  while (b - a > ENOUGH && ntries < MAX_TRIES - ENOUGH - 1) {
+	c = b - (int) ((b - a) / PHI + 0.5);
+	d = a + (int) ((b - a) / PHI + 0.5);
+	if (c >= d) break;
+	if (attempt(c)->mean >= attempt(d)->mean) b = d; else a = c;
+  }
+  for (t = a; t <= b; t++) attempt(t);
+
+  /* The best of all tries, and the ones that are as good within noise. */
+  best = &tries[0];
+  for (tp = tries; tp < &tries[ntries]; tp++)
+	if (tp->mean > best->mean) best = tp;
+  lo = hi = best->timeout;
+  for (tp = tries; tp < &tries[ntries]; tp++) {
+	if (paired(tp, best) < 0) continue;
+	if (tp->timeout < lo) lo = tp->timeout;
+	if (tp->timeout > hi) hi = tp->timeout;
+  }
+  if (opt_delay)
+	printf("\nBest timeout: %d, mean delay %.2f +- %.2f events (95%%)\n",
+		best->timeout, -best->mean, best->half);
+  else
+	printf("\nBest timeout: %d, efficiency %.2f%% +- %.2f%% (95%%)\n",
+		best->timeout, 100 * best->mean, 100 * best->half);
+  printf("Timeouts tried from %d to %d are not significantly worse\n",
+								lo, hi);
+  printf("Tried %d timeouts; a sweep from %d to %d takes %d\n", ntries,
+				opt_lo, opt_hi, opt_hi - opt_lo + 1);
+  return(0);
+}
+
+
+static struct try *attempt(int t)
+{
+/* Simulate timeout t on all the links, unless that was done before. */
+
+  int l;
+  double var;
+  struct try *tp;
+
+  for (tp = tries; tp < &tries[ntries]; tp++)
+	if (tp->timeout == t) return(tp);
+  tp = &tries[ntries++];
+  tp->timeout = t;
+  tp->x = (double *) malloc(links * sizeof(double));
+  if (tp->x == NULL) {
+	printf("Out of memory\n");
+	exit(1);
+  }
+  timeout_interval = DELTA * (bigint) t;
+  memset(res, 0, links * sizeof(struct result));
+  run_all(last_tick, res);
+  tp->mean = var = 0;
+  for (l = 0; l < links; l++) {
+	tp->x[l] = score(&res[l]);
+	tp->mean += tp->x[l] / links;
+  }
+  for (l = 0; l < links; l++)
+	var += (tp->x[l] - tp->mean) * (tp->x[l] - tp->mean) / (links - 1);
+  tp->half = t95(links - 1) * sqrt(var / links);
+  if (opt_delay)
+	printf("Timeout %5d: mean delay %.2f +- %.2f\n", t, -tp->mean,
+								tp->half);
+  else
+	printf("Timeout %5d: efficiency %.2f%% +- %.2f%%\n", t,
+					100 * tp->mean, 100 * tp->half);
+  return(tp);
+}
+
+
+static double score(struct result *r)
+{
+/* How good a link did; higher is better, so a delay counts against. */
+
+  bigint acc, sent;
+
+  if (opt_delay)
+	return(-(double) (r->stats[0][ST_DELAY] + r->stats[1][ST_DELAY]) / 2);
+  acc = r->stats[0][ST_PAYLOADS] + r->stats[1][ST_PAYLOADS];
+  sent = r->stats[0][ST_DATA_SENT] + r->stats[1][ST_DATA_SENT];
+  return(sent > 0 ? (double) acc / sent : 0);
+}
+
+
+static double paired(struct try *a, struct try *b)
+{
+/* The upper end of the 95% confidence interval of the mean of a's score
+ * minus b's, link by link; at least 0 if a may be as good as b.
+ */
+
+  int l;
+  double d, mean = 0, var = 0;
+
+  for (l = 0; l < links; l++) mean += (a->x[l] - b->x[l]) / links;
+  for (l = 0; l < links; l++) {
+	d = a->x[l] - b->x[l] - mean;
+	var += d * d / (links - 1);
+  }
+  return(mean + t95(links - 1) * sqrt(var / links));
+}
@@ -3,6 +3,7 @@
 #define MAX_SEQ 1	/* must be 1 for protocol 4 */
 typedef enum {frame_arrival, cksum_err, timeout} event_type;
 #include "protocol.h"
+extern int adaptive;	/* -a: the timeout adapts to the round trip time */
 
 void protocol4 (void)
 {
@@ -33,6 +34,7 @@ void protocol4 (void)
                 }
 
                 if (r.ack == next_frame_to_send) { /* handle outbound frame stream. */
+                        if (adaptive) stop_timer(r.ack);	/* -a: stop it, so the ack gives a sample */
                         from_network_layer(&buffer);	/* fetch new packet from network layer */
                         inc(next_frame_to_send);	/* invert sender's sequence number */
                 }
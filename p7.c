@@ -0,0 +1,154 @@
+/* Protocol 7 (selective acknowledgement) is protocol 6 with cheaper control traffic.
+   There are no naks. An ack frame has no packet to carry, so its info field holds a
+   bit map of the frames the receiver has buffered beyond the first one it is missing.
+   When a frame arrives out of order the receiver does not complain at once, as protocol
+   6 does, but waits until ACK_EVERY such frames have come in or the ack timer goes
+   off, so one ack frame reports them all; data frames going the other way carry
+   the cumulative ack but not the bit map, so they do not stop the ack timer while
+   there is something in it. The sender stops the timers of the frames the bit map
+   names and sends each hole below them again, once; a frame is otherwise resent
+   only when its own timer goes off. */
+
+#define MAX_SEQ 7	/* should be 2^n - 1 */
+#define NR_BUFS ((MAX_SEQ + 1)/2)
+#define ACK_EVERY 2	/* out of order arrivals reported per ack frame */
+typedef enum {frame_arrival, cksum_err, timeout, network_layer_ready, ack_timeout} event_type;
+#include "protocol.h"
+extern seq_nr oldest_frame;	/* set by the simulator on a timeout */
+
+static boolean between(seq_nr a, seq_nr b, seq_nr c)
+{
+/* Same as between in protocol6. */
+  return ((a <= b) && (b < c)) || ((c < a) && (a <= b)) || ((b < c) && (c < a));
+}
+
+static void send_frame(frame_kind fk, seq_nr frame_nr, seq_nr frame_expected, packet buffer[], boolean arrived[])
+{
+/* Construct and send a data or ack frame. Bit i of the bit map says whether
+   frame frame_expected + i is buffered at the receiver. */
+  frame s;	/* scratch variable */
+  int i;	/* bit number */
+  unsigned char map;	/* bit map */
+
+  map = 0;
+  for (i = 0; i < NR_BUFS; i++)
+        if (arrived[(frame_expected + i) % NR_BUFS]) map |= 1 << i;
+  s.kind = fk;	/* kind == data or ack */
+  if (fk == data) {
+        s.info = buffer[frame_nr % NR_BUFS];
+  } else {
+        for (i = 0; i < MAX_PKT; i++) s.info.data[i] = 0;
+        s.info.data[0] = map;
+  }
+  s.seq = frame_nr;	/* only meaningful for data frames */
+  s.ack = (frame_expected + MAX_SEQ) % (MAX_SEQ + 1);
+  to_physical_layer(&s);	/* transmit the frame */
+  if (fk == data) start_timer(frame_nr % NR_BUFS);
+  if (fk == ack || map == 0) stop_ack_timer();	/* no need for separate ack frame */
+}
+
+void protocol7(void)
+{
+  seq_nr ack_expected;	/* lower edge of sender's window */
+  seq_nr next_frame_to_send;	/* upper edge of sender's window + 1 */
+  seq_nr frame_expected;	/* lower edge of receiver's window */
+  seq_nr too_far;	/* upper edge of receiver's window + 1 */
+  seq_nr s;	/* sequence number named by a bit of the bit map */
+  int i;	/* index into buffer pool */
+  frame r;	/* scratch variable */
+  packet out_buf[NR_BUFS];	/* buffers for the outbound stream */
+  packet in_buf[NR_BUFS];	/* buffers for the inbound stream */
+  boolean arrived[NR_BUFS];	/* inbound bit map */
+  boolean sacked[NR_BUFS];	/* outbound frames the receiver has buffered */
+  boolean resent[NR_BUFS];	/* outbound holes already sent again */
+  seq_nr nbuffered;	/* how many output buffers currently used */
+  int held;	/* out of order arrivals not yet reported */
+  event_type event;
+
+  enable_network_layer();	/* initialize */
+  ack_expected = 0;	/* next ack expected on the inbound stream */
+  next_frame_to_send = 0;	/* number of next outgoing frame */
+  frame_expected = 0;	/* frame number expected */
+  too_far = NR_BUFS;	/* receiver's upper window + 1 */
+  nbuffered = 0;	/* initially no packets are buffered */
+  held = 0;	/* nothing to report yet */
+
+  for (i = 0; i < NR_BUFS; i++) arrived[i] = sacked[i] = resent[i] = false;
+  while (true) {
+     wait_for_event(&event);	/* five possibilities: see event_type above */
+     switch(event) {
+        case network_layer_ready:	/* accept, save, and transmit a new frame */
+                nbuffered = nbuffered + 1;	/* expand the window */
+                from_network_layer(&out_buf[next_frame_to_send % NR_BUFS]); /* fetch new packet */
+                sacked[next_frame_to_send % NR_BUFS] = false;
+                resent[next_frame_to_send % NR_BUFS] = false;
+                send_frame(data, next_frame_to_send, frame_expected, out_buf, arrived);	/* transmit the frame */
+                inc(next_frame_to_send);	/* advance upper window edge */
+                break;
+
+        case frame_arrival:	/* a data or control frame has arrived */
+                from_physical_layer(&r);	/* fetch incoming frame from physical layer */
+                if (r.kind == data) {
+                        /* An undamaged frame has arrived. */
+                        if (r.seq != frame_expected && between(frame_expected, r.seq, too_far)) {
+                                /* There is a hole: report it along with any others soon. */
+                                held = held + 1;
+                                if (held == 1) start_ack_timer();
+                        } else if (held == 0) {
+                                start_ack_timer();	/* to see if a separate ack is needed */
+                        }
+                        if (between(frame_expected, r.seq, too_far) && (arrived[r.seq%NR_BUFS] == false)) {
+                                /* Frames may be accepted in any order. */
+                                arrived[r.seq % NR_BUFS] = true;	/* mark buffer as full */
+                                in_buf[r.seq % NR_BUFS] = r.info;	/* insert data into buffer */
+                                while (arrived[frame_expected % NR_BUFS]) {
+                                        /* Pass frames and advance window. */
+                                        to_network_layer(&in_buf[frame_expected % NR_BUFS]);
+                                        arrived[frame_expected % NR_BUFS] = false;
+                                        inc(frame_expected);	/* advance lower edge of receiver's window */
+                                        inc(too_far);	/* advance upper edge of receiver's window */
+                                }
+                        }
+                        if (held >= ACK_EVERY) {
+                                send_frame(ack, 0, frame_expected, out_buf, arrived);
+                                held = 0;
+                        }
+                }
+
+                while (between(ack_expected, r.ack, next_frame_to_send)) {
+                        nbuffered = nbuffered - 1;	/* handle piggybacked ack */
+                        stop_timer(ack_expected % NR_BUFS);	/* frame arrived intact */
+                        inc(ack_expected);	/* advance lower edge of sender's window */
+                }
+
+                if (r.kind == ack) {
+                        /* Stop the timers of the frames the receiver holds; send the holes below them again. */
+                        for (i = NR_BUFS - 1; i > 0; i--) {
+                                s = (r.ack + 1 + i) % (MAX_SEQ + 1);
+                                if ((r.info.data[0] & (1 << i)) && between(ack_expected, s, next_frame_to_send) && !sacked[s % NR_BUFS]) {
+                                        sacked[s % NR_BUFS] = true;
+                                        stop_timer(s % NR_BUFS);
+                                }
+                        }
+                        for (i = NR_BUFS - 1; i >= 0; i--) {
+                                s = (r.ack + 1 + i) % (MAX_SEQ + 1);
+                                if (between(ack_expected, s, next_frame_to_send) && sacked[s % NR_BUFS]) break;
+                        }
+                        for (i = i - 1; i >= 0; i--) {
+                                s = (r.ack + 1 + i) % (MAX_SEQ + 1);
+                                if (between(ack_expected, s, next_frame_to_send) && !sacked[s % NR_BUFS] && !resent[s % NR_BUFS]) {
+                                        resent[s % NR_BUFS] = true;
+                                        send_frame(data, s, frame_expected, out_buf, arrived);
+                                }
+                        }
+                }
+                break;
+
+        case cksum_err: break;	/* damaged frame: a later bit map or the timer will tell */
+        case timeout: send_frame(data, oldest_frame, frame_expected, out_buf, arrived); break;	/* we timed out */
+        case ack_timeout: send_frame(ack, 0, frame_expected, out_buf, arrived); held = 0;	/* ack timer expired; send ack */
+     }
+
+     if (nbuffered < NR_BUFS) enable_network_layer(); else disable_network_layer();
+  }
+}
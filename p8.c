@@ -0,0 +1,112 @@
+/* Protocol 8 (multichannel stop-and-wait) runs K copies of protocol 4 side by side,
+   the way the IMPs of the ARPANET shared a line.  Packet n goes out on channel
+   n % K; each channel has its own alternating bit and its own timer, and takes a
+   new packet only once the one on it is acknowledged.  The receiver keeps one
+   packet per channel: one that comes in ahead of its turn waits there until the
+   packets before it have been passed on, so the network layer still gets them in
+   order.  Every frame carries the bits the receiver expects next on all K
+   channels, so any frame going back acknowledges them all; if none goes back in
+   time, the ack timer sends an ack frame.  K is given with the protocol number,
+   as in 8:4, and is at most MAX_CHAN; 8 alone means 8:4, which holds as many
+   packets as protocol 6 does. */
+
+#define MAX_CHAN 8	/* one timer per channel */
+typedef enum {frame_arrival, cksum_err, timeout, network_layer_ready, ack_timeout} event_type;
+#include "protocol.h"
+extern seq_nr oldest_frame;	/* set by the simulator on a timeout */
+extern int channels;	/* K, from the command line */
+
+static void send_frame(frame_kind fk, int c, seq_nr bit[], packet buffer[], seq_nr expected[])
+{
+/* Construct and send a data frame on channel c, or an ack frame.  The seq field
+   holds 2c plus the channel's bit, and bit i of the ack field is the bit
+   expected next on channel i. */
+  frame s;	/* scratch variable */
+  int i;	/* channel number */
+
+  s.kind = fk;	/* kind == data or ack */
+  if (fk == data) s.info = buffer[c];
+  s.seq = 2 * c + bit[c];	/* only meaningful for data frames */
+  s.ack = 0;
+  for (i = 0; i < channels; i++) s.ack |= expected[i] << i;
+  to_physical_layer(&s);	/* transmit the frame */
+  if (fk == data) start_timer(c);
+  stop_ack_timer();	/* no need for separate ack frame */
+}
+
+void protocol8(void)
+{
+  int c;	/* a channel */
+  int next_out;	/* channel of the next packet from the network layer */
+  int next_in;	/* channel of the next packet for the network layer */
+  seq_nr bit[MAX_CHAN];	/* bit of the frame on each outbound channel */
+  boolean busy[MAX_CHAN];	/* is that frame still unacknowledged? */
+  packet out_buf[MAX_CHAN];	/* the packet on each outbound channel */
+  seq_nr expected[MAX_CHAN];	/* bit expected next on each inbound channel */
+  boolean held[MAX_CHAN];	/* is a packet waiting for its turn? */
+  packet in_buf[MAX_CHAN];	/* the packet waiting on each inbound channel */
+  boolean owed;	/* is the ack timer running? */
+  frame r;	/* scratch variable */
+  event_type event;
+
+  enable_network_layer();	/* initialize */
+  next_out = 0;	/* packet 0 goes on channel 0 */
+  next_in = 0;	/* and comes off it first */
+  for (c = 0; c < MAX_CHAN; c++) {
+        bit[c] = 0;
+        busy[c] = false;
+        expected[c] = 0;
+        held[c] = false;
+  }
+  owed = false;
+
+  while (true) {
+     wait_for_event(&event);	/* five possibilities: see event_type above */
+     switch(event) {
+        case network_layer_ready:	/* the next channel is free: send on it */
+                from_network_layer(&out_buf[next_out]);	/* fetch new packet */
+                busy[next_out] = true;
+                send_frame(data, next_out, bit, out_buf, expected);
+                owed = false;
+                next_out = (next_out + 1) % channels;
+                break;
+
+        case frame_arrival:	/* a data or control frame has arrived */
+                from_physical_layer(&r);	/* fetch incoming frame from physical layer */
+                if (r.kind == data) {
+                        c = r.seq / 2;
+                        if (r.seq % 2 == expected[c] && !held[c]) {
+                                /* A new packet: keep it until its turn comes. */
+                                in_buf[c] = r.info;
+                                held[c] = true;
+                                expected[c] = 1 - expected[c];
+                                while (held[next_in]) {
+                                        /* Pass packets on in order. */
+                                        to_network_layer(&in_buf[next_in]);
+                                        held[next_in] = false;
+                                        next_in = (next_in + 1) % channels;
+                                }
+                        }
+                        /* A frame refused, or sent again, is acked too. */
+                        if (!owed) start_ack_timer();
+                        owed = true;
+                }
+
+                for (c = 0; c < channels; c++) {
+                        if (busy[c] && ((r.ack >> c) & 1) != bit[c]) {
+                                /* The frame on channel c got there. */
+                                busy[c] = false;
+                                stop_timer(c);
+                                bit[c] = 1 - bit[c];
+                        }
+                }
+                break;
+
+        case cksum_err: break;	/* damaged frame: the timer will tell */
+        case timeout: send_frame(data, oldest_frame / 2, bit, out_buf, expected); owed = false; break;	/* we timed out */
+        case ack_timeout: send_frame(ack, 0, bit, out_buf, expected); owed = false;	/* ack timer expired; send ack */
+     }
+
+     if (busy[next_out]) disable_network_layer(); else enable_network_layer();
+  }
+}
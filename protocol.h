@@ -10,10 +10,14 @@ typedef struct {	/* frames are transported in this layer */
   seq_nr seq;   	/* sequence number */
   seq_nr ack;   	/* acknowledgement number */
   packet info;  	/* the network layer packet */
+  unsigned int cksum;	/* CRC, filled in by the physical layer (-k) */
+  unsigned int conn;	/* connection it belongs to, on a link with many (-q) */
 } frame;
 
-/* Wait for an event to happen; return its type in event. */
-void wait_for_event(event_type *event);
+/* Wait for an event to happen; return its type in event.  Returns_twice
+   makes the protocol keep its variables in memory across the call, where
+   exploration (-v) looks for them. */
+void wait_for_event(event_type *event) __attribute__((returns_twice));
 
 /* Fetch a packet from the network layer for transmission on the channel. */
 void from_network_layer(packet *p);
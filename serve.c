@@ -0,0 +1,205 @@
+/* Simulation server (-z).
+ *
+ * Studies that run tens of thousands of short simulations spend most of
+ * their time starting sim: a process, its pipes, its workers.  With
+ *
+ *	sim -z /tmp/sim.sock -j 8
+ *
+ * sim instead listens on a Unix domain socket with 8 worker processes
+ * forked in advance, all waiting in accept().  A client connects and sends
+ * requests, one per line, each the arguments of a run as they would follow
+ * sim on the command line:
+ *
+ *	-s 7 -l 4 5 10000 40 10 10 0
+ *
+ * The worker that took the connection parses them with parse_args(), runs
+ * the links with the in-process engine (engine.c) in its own process, and
+ * answers with a struct reply, then the text the run printed (the header
+ * line, any debug output or complaint), then one struct result per link, as
+ * common.h lays them out for this binary.  A status other than 0 means the
+ * request was refused; the text says why.  The connection stays open for
+ * the next request.  Between runs nothing is forked or freed: parse_args()
+ * sets every option afresh, the engine keeps its memory, and each link
+ * starts its workers from the globals as they were before any run.
+ *
+ * Runs that fork or write elsewhere are not served: -b, -j, -m, -o, -c, -x
+ * and -v.  A worker that dies, say because a run called exit(), is
+ * replaced.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "common.h"
+
+#define MAX_LINE 4096		/* longest request */
+#define MAX_ARGS 64		/* most arguments in one */
+
+extern bigint last_tick;	/* when to stop, as parse_args() found (sim.c) */
+
+/* Prototypes. */
+static int listen_on(char *where);
+static void spawn(int fd);
+static void take(int fd);
+static int next_line(int c, char *buf, int *have, char *line);
+static void answer(int c, char *line);
+static void send_all(int c, char *p, long n);
+
+
+void serve_runs(void)
+{
+/* Start the workers and replace any that die, for good. */
+
+  int fd, j;
+  static int started;
+
+  if (started++) {		/* a request to a worker with -z */
+	printf("Already serving\n");
+	return;
+  }
+  if ((fd = listen_on(serve_at)) < 0) return;
+  printf("Serving runs on %s with %d workers\n", serve_at, jobs);
+  for (j = 0; j < jobs; j++) spawn(fd);
+  while (wait((int *) 0) > 0) spawn(fd);
+}
+
+
+static int listen_on(char *where)
+{
+/* Set up the Unix domain socket the workers take connections from. */
+
+  int fd;
+  struct sockaddr_un un;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&un, 0, sizeof(un));
+  un.sun_family = AF_UNIX;
+  strncpy(un.sun_path, where, sizeof(un.sun_path) - 1);
+  unlink(where);
+  if (fd < 0 || bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0) {
+	printf("Cannot serve runs on %s\n", where);
+	return(-1);
+  }
+  listen(fd, 128);
+  return(fd);
+}
+
+
+static void spawn(int fd)
+{
+/* Fork a worker.  What a run prints goes to a file of its own, from which
+ * it is sent back with the results.
+ */
+
+  FILE *out;
+
+  if (fork() != 0) return;
+  signal(SIGPIPE, SIG_IGN);	/* a client that hangs up is not fatal */
+  if ((out = tmpfile()) == NULL) exit(1);
+  dup2(fileno(out), 1);
+  init_engine();		/* before any run, as it must be */
+  for (;;) take(fd);
+}
+
+
+static void take(int fd)
+{
+/* Take one connection and answer its requests until the client hangs up. */
+
+  int c, have = 0;
+  char buf[MAX_LINE], line[MAX_LINE];
+
+  if ((c = accept(fd, (struct sockaddr *) 0, (socklen_t *) 0)) < 0) return;
+  while (next_line(c, buf, &have, line)) answer(c, line);
+  close(c);
+}
+
+
+static int next_line(int c, char *buf, int *have, char *line)
+{
+/* Copy the next line the client sent into line, without its newline, and
+ * keep what came after it in buf; 0 at the end.
+ */
+
+  int n;
+  char *nl;
+
+  while ((nl = memchr(buf, '\n', *have)) == NULL) {
+	if (*have == MAX_LINE) *have = 0;	/* too long: drop it */
+	if ((n = read(c, buf + *have, MAX_LINE - *have)) <= 0) return(0);
+	*have += n;
+  }
+  n = nl - buf;
+  memcpy(line, buf, n);
+  line[n] = 0;
+  *have -= n + 1;
+  memmove(buf, nl + 1, *have);
+  return(1);
+}
+
+
+static void answer(int c, char *line)
+{
+/* Run what the request asks for and send back the reply. */
+
+  int argc, n;
+  long at;
+  char *argv[MAX_ARGS + 1], buf[8192];
+  struct reply r;
+  struct result *res = NULL;
+
+  argv[0] = "sim";
+  argc = 1;
+  for (argv[argc] = strtok(line, " \t\r"); argv[argc] != NULL && argc <
+		MAX_ARGS; argv[argc] = strtok((char *) 0, " \t\r")) argc++;
+  argv[argc] = NULL;
+
+  ftruncate(1, 0);		/* the text of the run starts here */
+  lseek(1, 0, SEEK_SET);
+  optind = 1;
+  r.status = parse_args(argc, argv);
+  if (r.status == 0 && (engine == BATCH_ENGINE || jobs > 1 || metrics_at ||
+		columns_at || cache_at || rare_level || verify || serve_at)) {
+	printf("The server does not run -b, -j, -m, -o, -c, -x, -v or -z.\n");
+	r.status = -1;
+  }
+  r.links = 0;
+  if (r.status == 0) {
+	engine = INPROC_ENGINE;
+	res = (struct result *) calloc(links, sizeof(struct result));
+	if (res == NULL) {
+		printf("Out of memory\n");
+		r.status = -1;
+	} else {
+		run_quietly(last_tick, res);
+		r.links = links;
+	}
+  }
+  r.text = lseek(1, 0, SEEK_CUR);
+  send_all(c, (char *) &r, sizeof(r));
+  for (at = 0; at < r.text; at += n) {
+	if ((n = pread(1, buf, sizeof(buf), at)) <= 0) break;
+	send_all(c, buf, n);
+  }
+  if (res != NULL) send_all(c, (char *) res, r.links * sizeof(*res));
+  free(res);
+}
+
+
+static void send_all(int c, char *p, long n)
+{
+/* Write all n bytes, or give up if the client has gone. */
+
+  long k;
+
+  while (n > 0 && (k = write(c, p, n)) > 0) {
+	p += k;
+	n -= k;
+  }
+}
@@ -11,22 +11,25 @@
 #include <stdio.h>
 #include "common.h"
 
-#define DEADLOCK (3 * timeout_interval)	/* defines what a deadlock is */
-#define MAX_PROTOCOL 6		/* highest protocol being simulated */
+#define MAX_PROTOCOL 8		/* highest protocol being simulated */
 #define MANY 256		/* big enough to clear pipe at the end */
 
 bigint tick = 0;		/* the current time, measured in events */
 bigint last_tick;		/* when to stop the simulation */
 int exited[2];			/* set if exited (for each worker) */
-int hanging[2];			/* # times a process has done nothing */
+bigint last_word[2];		/* each process's last reply */
+bigint sched_rng;		/* main's random number stream */
+int lockstep;			/* wait for each worker's reply (-d) */
+char run_key[512];		/* what the results depend on (-c), or "" */
 struct sigaction act, oact;
 
 /* Prototypes. */
 void main(int argc, char *argv[]);
-int parse_args(int argc, char *argv[]);
 void set_up_pipes(void);
 void fork_off_workers(void);
+void run_lockstep(void);
 void terminate(char *s);
+void show_windows(void);
 void sender2(void);
 void receiver2(void);
 void sender3(void);
@@ -34,12 +37,14 @@ void receiver3(void);
 void protocol4(void);
 void protocol5(void);
 void protocol6(void);
+void protocol7(void);
+void protocol8(void);
 
 void main(int argc, char *argv[])
 {
 /* The simulator has three processes: main, M0, and M1, all of which run
  * independently.  Set them all up first.  Once set up, main maintains the
- * clock (tick), and picks a process to run.  Then it writes a 32-bit word
+ * clock (tick), and picks a process to run.  Then it writes the time
  * to that process to tell it to run.  The process sends back an answer
  * when it is done.  Main then picks another process, and the cycle repeats.
  */
@@ -47,23 +52,39 @@ void main(int argc, char *argv[])
   int process = 0;		/* whose turn is it */
   int rfd, wfd;			/* file descriptor for talking to workers */
   bigint word;			/* message from worker */
+  int c;			/* what parse_args() found */
 
   act.sa_handler = SIG_IGN;
   setvbuf(stdout, (char *) 0, _IONBF, (size_t) 0);	/* disable buffering*/
-  if (parse_args(argc, argv) < 0) exit(1);     /* check args; store in mem */
+  if ((c = parse_args(argc, argv)) != 0)	/* check args; store in mem */
+	exit(c < 0 ? 1 : 0);
+  if (cache_at != NULL && run_key[0] != 0) use_cache(run_key);
+  if (verify) exit(explore());	/* every run, not one; see explore.c */
+  if (opt_lo > 0) exit(optimize());	/* many timeouts; see optimize.c */
+  if (engine != FORK_ENGINE) {
+	run_engine(last_tick);	/* workers as coroutines; see engine.c */
+	exit(0);
+  }
+  sched_rng = stream_seed(0, 2);
+  tick = first_tick;
+  if (metrics_at != NULL) start_metrics(3, last_tick);	/* M0, M1, main */
+  if (columns_at != NULL) start_columns(1);	/* M0 and M1 share it */
   set_up_pipes();		/* create five pipes */
   fork_off_workers();		/* fork off the worker processes */
+  if (lockstep) run_lockstep();
 
   /* Main simulation loop. */
   while (tick <last_tick) {
-	process = rand() & 1;		/* pick process to run: 0 or 1 */
+	process = next_random(&sched_rng) & 1;	/* pick process: 0 or 1 */
 	tick = tick + DELTA;
 	rfd = (process == 0 ? r4 : r6);
 	if (read(rfd, &word, TICK_SIZE) != TICK_SIZE) terminate("");
-	if (word == OK) hanging[process] = 0;
-	if (word == NOTHING) hanging[process] += DELTA;
-	if (hanging[0] >= DEADLOCK && hanging[1] >= DEADLOCK)
+	last_word[process] = word;
+	if (quiescent(last_word)) {
+		show_windows();
 		terminate("A deadlock has been detected");
+	}
+	if (tick % (PUBLISH * DELTA) == 0) publish(2, tick/DELTA, 1, 0, 0);
 
 	/* Write the time to the selected process to tell it to run. */
 	wfd = (process == 0 ? w3 : w5);
@@ -77,19 +98,292 @@ void main(int argc, char *argv[])
 }
 
 
+void run_lockstep(void)
+{
+/* The main loop above lets a worker run while main picks the next one, so
+ * when a frame reaches the peer depends on how the processes get scheduled
+ * and no two runs are alike.  With -d main waits for the reply of each
+ * worker before going on, so every frame sent is in the pipe by the time
+ * the peer runs.  That is the order in which the in-process engine runs
+ * the workers, and with the same seed the two give the same results.
+ */
+
+  int process;
+  bigint word;
+
+  if (read(r4, &last_word[0], TICK_SIZE) != TICK_SIZE) exited[0] = 1;
+  if (read(r6, &last_word[1], TICK_SIZE) != TICK_SIZE) exited[1] = 1;
+  while (tick < last_tick) {
+	process = next_random(&sched_rng) & 1;	/* pick process: 0 or 1 */
+	tick = tick + DELTA;
+	if (exited[process]) terminate("");
+	if (quiescent(last_word)) {
+		show_windows();
+		terminate("A deadlock has been detected");
+	}
+	if (tick % (PUBLISH * DELTA) == 0) publish(2, tick/DELTA, 1, 0, 0);
+	write(process == 0 ? w3 : w5, &tick, TICK_SIZE);
+	if (read(process == 0 ? r4 : r6, &word, TICK_SIZE) != TICK_SIZE)
+		exited[process] = 1;
+	else
+		last_word[process] = word;
+  }
+  terminate("End of simulation");
+}
+
+
 int parse_args(int argc, char *argv[])
 {
-/* Inspect args on the command line and save them. */
-  if (argc != 7) {
-	printf("Usage: sim protocol events timeout loss cksum debug\n");
+/* Inspect args on the command line and save them.  The options come first:
+ *	-i		use the in-process engine (engine.c) for one link
+ *	-s seed		seed for the random number streams (default 1)
+ *	-l links	simulate this many independent links (in-process)
+ *	-j jobs		spread the links over this many processes
+ *	-b		use the batch engine (batch.c); protocols 5 and 6 only
+ *	-d		run the fork engine in lockstep, so it is repeatable
+ *	-a		adapt the timeout to the measured round trip time
+ *	-t source	traffic source of M0 (and of M1 unless -u is given)
+ *	-u source	traffic source of M1
+ *	-p precision	stop a link once its results are this precise; the
+ *			events parameter is then only a cap (in-process)
+ *	-m where	serve live metrics on this loopback port or socket
+ *	-o dir		write result files of frames and packets into dir
+ *	-c dir		reuse the results of runs done before, kept in dir
+ *	-k crc		checksum frames for real with crc32 or crc32c
+ *	-e ber		garble bits at this bit error rate instead of frames
+ *	-w		find the end of the warm-up and leave it out (in-process)
+ *	-n		common random numbers: the channel's decisions depend
+ *			only on the direction and the number of the frame
+ *	-x K:R		estimate the chance of K timeouts in a row by splitting
+ *			each run R ways at every level below K (in-process);
+ *			R = 1 is plain simulation
+ *	-q conns	multiplex this many connections of protocol 5 or 6
+ *			on each link, over one pipe each way (mux.c)
+ *	-v P:F		explore every run of the protocol until P packets
+ *			are delivered, with at most F frames on the way
+ *	-f lo:hi	search for the timeout from lo to hi with the best
+ *			efficiency, on the links (16 unless -l is given);
+ *			-f lo:hi:delay for the least packet delay instead
+ *	-y policy	how main picks the worker to run: uniform (the
+ *			default), ready, round or weighted:W0:W1; all but
+ *			uniform skip turns in which a worker has nothing to do
+ *	-g N:mode	N stations, two per connection, share one medium
+ *			under mode aloha or csma; N:mode:air for frames
+ *			that take air events to send (in-process)
+ *	-S events	start the clock at this many events instead of 0, to
+ *			try long runs (past 2^32 ticks) without their length
+ *	-z socket	serve runs asked for on this Unix socket, with -j
+ *			workers; no parameters follow
+ *	-r		with -c, empty the cache instead of running
+ * It returns 1 if nothing is to be run.
+ */
+  int c, n, clear = 0, opt = 0;
+  char word[6];
+  char *src0 = NULL, *src1 = NULL;
+
+  engine = FORK_ENGINE;
+  seed = 1;
+  links = 1;
+  jobs = 1;
+  adaptive = 0;
+  sources = 0;
+  precision = 0;
+  lockstep = 0;
+  metrics_at = NULL;
+  columns_at = NULL;
+  cache_at = NULL;
+  checksum = NO_CRC;
+  ber = 0;
+  warmup = 0;
+  common = 0;
+  rare_level = 0;
+  rare_split = 0;
+  verify = 0;
+  in_flight = 0;
+  conns = 1;
+  serve_at = NULL;
+  opt_lo = opt_hi = 0;
+  opt_delay = 0;
+  policy = POL_UNIFORM;
+  weight[0] = weight[1] = 1;
+  medium = MED_NONE;
+  stations = 0;
+  air = 4;
+  first_tick = 0;
+  reset_sources();
+  while ((c = getopt(argc, argv, "ibdas:l:j:t:u:p:m:o:c:rk:e:wnx:q:v:z:f:y:g:S:")) != -1) {
+	switch(c) {
+	    case 'i':	engine = INPROC_ENGINE;	break;
+	    case 'b':	engine = BATCH_ENGINE;	break;
+	    case 'd':	lockstep = 1;	break;
+	    case 'a':	adaptive = 1;	break;
+	    case 's':	seed = strtoul(optarg, (char **) 0, 10);	break;
+	    case 'l':	links = atoi(optarg);	break;
+	    case 'j':	jobs = atoi(optarg);	break;
+	    case 't':	src0 = optarg;	break;
+	    case 'u':	src1 = optarg;	break;
+	    case 'p':	precision = atof(optarg);	break;
+	    case 'm':	metrics_at = optarg;	break;
+	    case 'o':	columns_at = optarg;	break;
+	    case 'c':	cache_at = optarg;	break;
+	    case 'r':	clear = 1;	break;
+	    case 'k':	checksum = (strcmp(optarg, "crc32c") == 0 ? CRC32C :
+				strcmp(optarg, "crc32") == 0 ? CRC32 : -1);
+			break;
+	    case 'e':	ber = atof(optarg);	break;
+	    case 'w':	warmup = 1;	break;
+	    case 'n':	common = 1;	break;
+	    case 'x':	if (sscanf(optarg, "%d:%d", &rare_level,
+						&rare_split) != 2) rare_level = -1;
+			break;
+	    case 'q':	conns = atoi(optarg);	break;
+	    case 'v':	if (sscanf(optarg, "%d:%d", &verify,
+						&in_flight) != 2) verify = -1;
+			break;
+	    case 'z':	serve_at = optarg;	break;
+	    case 'y':	policy = (strcmp(optarg, "uniform") == 0 ? POL_UNIFORM :
+				strcmp(optarg, "ready") == 0 ? POL_READY :
+				strcmp(optarg, "round") == 0 ? POL_ROUND : -1);
+			if (sscanf(optarg, "weighted:%d:%d", &weight[0],
+					&weight[1]) == 2) policy = POL_WEIGHTED;
+			break;
+	    case 'g':	n = sscanf(optarg, "%d:%5[a-z]:%d", &stations, word,
+									&air);
+			medium = (n < 2 ? -1 : strcmp(word, "aloha") == 0 ?
+				MED_ALOHA : strcmp(word, "csma") == 0 ?
+							MED_CSMA : -1);
+			break;
+	    case 'S':	first_tick = strtoul(optarg, (char **) 0, 10);	break;
+	    case 'f':	opt = 1;
+			n = sscanf(optarg, "%d:%d:%5s", &opt_lo, &opt_hi, word);
+			if (n < 2 || (n == 3 && strcmp(word, "delay")))
+				opt_lo = -1;
+			opt_delay = (n == 3);
+			break;
+	    default:	argc = 0;	break;	/* force the usage message */
+	}
+  }
+  if (clear && cache_at != NULL && argc - optind == 0) {
+	clear_cache();
+	return(1);
+  }
+  if (serve_at != NULL && argc - optind == 0) {
+	serve_runs();
+	return(1);
+  }
+  if (argc - optind != 6) {
+	printf("Usage: sim [-i] [-b] [-d] [-a] [-s seed] [-l links] [-j jobs] [-t source] [-u source] [-p precision] [-m where] [-o dir] [-c dir [-r]] [-k crc32|crc32c] [-e ber] [-w] [-n] [-x K:R] [-q conns] [-v P:F] [-f lo:hi[:delay]] [-y policy] [-g N:mode[:air]] [-S events] [-z socket] protocol events timeout loss cksum debug\n");
 	return(-1);
   }
+  argv += optind - 1;		/* so the parameters are argv[1] to argv[6] */
 
-  protocol = atoi(argv[1]);
+  if (links < 1 || jobs < 1) {
+	printf("Number of links and jobs must be positive\n");
+	return(-1);
+  }
+  if (precision < 0 || precision >= 1) {
+	printf("Precision must be between 0 and 1, e.g. 0.01 for 1%%\n");
+	return(-1);
+  }
+  if (opt && links == 1) links = 16;	/* replications of each timeout */
+  if ((links > 1 || jobs > 1 || precision > 0 || warmup || rare_level ||
+			verify || conns > 1 || policy != POL_UNIFORM ||
+					medium != MED_NONE) &&
+						engine == FORK_ENGINE)
+	engine = INPROC_ENGINE;
+  if (opt && engine != BATCH_ENGINE) common = 1;	/* see optimize.c */
+  if (warmup && engine == BATCH_ENGINE) {
+	printf("Warm-up truncation (-w) needs the in-process engine.\n");
+	return(-1);
+  }
+  if (common && engine == BATCH_ENGINE) {
+	printf("Common random numbers (-n) are not done by the batch engine.\n");
+	return(-1);
+  }
+  if (rare_level != 0 && (rare_level < 2 || rare_split < 1 ||
+	engine == BATCH_ENGINE || common || metrics_at || columns_at)) {
+	printf("Splitting (-x K:R) needs K of 2 or more, R of 1 or more, and not -b, -n, -m or -o.\n");
+	return(-1);
+  }
+
+  channels = 4;
+  n = sscanf(argv[1], "%d:%d", &protocol, &channels);
   if (protocol < 2 || protocol > MAX_PROTOCOL) {
 	printf("Protocol %d is not valid.\n", protocol);
 	return(-1);
   }
+  if ((n == 2 && protocol != 8) || channels < 1 || channels > 8) {
+	printf("Only protocol 8 has channels (8:K), and K must be 1 to 8.\n");
+	return(-1);
+  }
+  if (engine == BATCH_ENGINE && protocol != 5 && protocol != 6) {
+	printf("The batch engine runs only protocols 5 and 6.\n");
+	return(-1);
+  }
+
+  /* A traffic source makes sense only where the network layer can say it
+   * has a packet, that is, with the network_layer_ready event.
+   */
+  if (src1 == NULL) src1 = src0;
+  if (src0 != NULL && parse_source(0, src0) < 0) return(-1);
+  if (src1 != NULL && parse_source(1, src1) < 0) return(-1);
+  if (sources && (protocol < 5 || engine == BATCH_ENGINE)) {
+	printf("Traffic sources need protocol 5 to 8 and no -b.\n");
+	return(-1);
+  }
+  if (columns_at != NULL && engine == BATCH_ENGINE) {
+	printf("The batch engine writes no result files (-o).\n");
+	return(-1);
+  }
+  if (checksum < 0 || (checksum != NO_CRC && engine == BATCH_ENGINE)) {
+	printf("Checksums (-k) are crc32 or crc32c, and not with -b.\n");
+	return(-1);
+  }
+  if (checksum != NO_CRC) init_crc();
+  if (ber < 0 || ber >= 1 || (ber > 0 && engine == BATCH_ENGINE)) {
+	printf("Bit error rate (-e) must be between 0 and 1, and not with -b.\n");
+	return(-1);
+  }
+  if (verify != 0 && (verify < 1 || in_flight < 1 || engine == BATCH_ENGINE ||
+	adaptive || sources || precision > 0 || metrics_at || columns_at ||
+	checksum != NO_CRC || ber > 0 || warmup || common || rare_level)) {
+	printf("Exploring (-v P:F) needs P and F of 1 or more, and not -b, -a, -t, -u, -p, -m, -o, -k, -e, -w, -n or -x.\n");
+	return(-1);
+  }
+  if (medium != MED_NONE && (medium < 0 || stations < 2 || stations % 2 ||
+	air < 1 || conns > 1 || engine == BATCH_ENGINE || precision > 0 ||
+	metrics_at || columns_at || warmup || rare_level || verify)) {
+	printf("A shared medium (-g N:mode:air) needs an even N of 2 or more, aloha or csma, air of 1 or more, and not -b, -q, -p, -m, -o, -w, -x or -v.\n");
+	return(-1);
+  }
+  if (conns > 1 && ((protocol != 5 && protocol != 6) || sources ||
+	checksum != NO_CRC || ber > 0 || common)) {
+	printf("Multiplexing (-q conns) runs protocols 5 and 6 only, and not with -t, -u, -k, -e, -n or -f.\n");
+	return(-1);
+  }
+  if (medium != MED_NONE) conns = stations / 2;
+  if (conns < 1 || (conns > 1 && (engine == BATCH_ENGINE || precision > 0 ||
+	metrics_at || columns_at || warmup || rare_level || verify))) {
+	printf("Multiplexing (-q conns) needs 1 connection or more, and not -b, -p, -m, -o, -w, -x or -v.\n");
+	return(-1);
+  }
+  if (policy < 0 || (policy == POL_WEIGHTED && (weight[0] < 0 ||
+	weight[1] < 0 || weight[0] + weight[1] < 1)) || (policy != POL_UNIFORM &&
+	(engine == BATCH_ENGINE || precision > 0 || warmup || metrics_at ||
+								verify))) {
+	printf("Scheduling (-y) must be uniform, ready, round or weighted:W0:W1; only uniform goes with -b, -p, -w, -m or -v.\n");
+	return(-1);
+  }
+  if (opt && (opt_lo < 1 || opt_hi < opt_lo + 2 || adaptive || precision > 0 ||
+	metrics_at || columns_at || warmup || rare_level || verify ||
+					(opt_delay && !sources))) {
+	printf("Searching (-f lo:hi) needs 1 <= lo, lo + 2 <= hi, a source (-t or -u) for delay, and not -a, -p, -m, -o, -w, -x or -v.\n");
+	return(-1);
+  }
+  if (first_tick > 0 && (precision > 0 || warmup || metrics_at || verify)) {
+	printf("Starting the clock late (-S) does not go with -p, -w, -m or -v.\n");
+	return(-1);
+  }
 
   /* Each event uses DELTA ticks to make it possible for each timeout to
    * occur at a different tick.  For example, with DELTA = 10, ticks will
@@ -106,6 +400,12 @@ int parse_args(int argc, char *argv[])
 	printf("Number of simulation events must be positive\n");
 	return(-1);
   }
+  if (first_tick > (NEVER/2 - last_tick)/DELTA) {
+	printf("The clock cannot start that late (-S)\n");
+	return(-1);
+  }
+  first_tick = DELTA * first_tick;	/* the run goes on from there */
+  last_tick = first_tick + last_tick;
 
   /* Convert from external units to internal units so the user does not see
    * the internal units at all.
@@ -148,9 +448,34 @@ int parse_args(int argc, char *argv[])
 	printf("Debug flags may not be negative\n", debug_flags);
 	return(-1);
   }
-  printf("\n\nProtocol %d.   Events: %u    Parameters: %u %d %u\n", protocol,
-      last_tick/DELTA, timeout_interval/DELTA, pkt_loss/10, garbled/10,
+  /* Runs that can be repeated, and only print, can be cached. */
+  run_key[0] = 0;
+  if ((engine != FORK_ENGINE || lockstep) && metrics_at == NULL &&
+	columns_at == NULL && (src0 == NULL || strncmp(src0, "trace:", 6)) &&
+				(src1 == NULL || strncmp(src1, "trace:", 6)))
+	snprintf(run_key, sizeof(run_key),
+		"%d %d %d %d %d %d %d:%d %d:%d %d %d:%d:%d %d:%d:%d %d:%d %g %lu %d %d %g %s %s %d:%d %lu %lu %lu %d %d %d",
+		engine, lockstep, adaptive, warmup, common, checksum,
+		rare_level, rare_split, verify, in_flight, conns, opt_lo,
+		opt_hi, opt_delay, policy, weight[0], weight[1], medium, air, ber, seed, links,
+		jobs, precision,
+		src0 == NULL ? "-" : src0, src1 == NULL ? "-" : src1,
+		protocol, channels, first_tick, last_tick, timeout_interval, pkt_loss,
+		garbled,
+		debug_flags);
+
+  printf("\n\nProtocol %d.   Events: %lu    Parameters: %lu %d %d\n", protocol,
+      (last_tick - first_tick)/DELTA, timeout_interval/DELTA, pkt_loss/10, garbled/10,
 								debug_flags);
+  if (protocol == 8) printf("Channels: %d\n", channels);
+  if (first_tick > 0) printf("Clock starts at: %lu events\n", first_tick/DELTA);
+  if (policy == POL_WEIGHTED)
+	printf("Scheduling: weighted %d:%d\n", weight[0], weight[1]);
+  else if (policy != POL_UNIFORM)
+	printf("Scheduling: %s\n", policy == POL_READY ? "ready" : "round");
+  if (medium != MED_NONE)
+	printf("Medium: %s, %d stations, %d events a frame\n", medium ==
+				MED_ALOHA ? "ALOHA" : "CSMA", stations, air);
   return(0);			/* no errors in command line parameters */
 }
 
@@ -204,12 +529,16 @@ void fork_off_workers(void)
 		mrfd = r5;	/* fd for reading time from main */
 		mwfd = w6;	/* fd for writing reply to main */
 		prfd = r1;	/* fd for reading frames from worker 0 */
+		if (columns_at != NULL) open_columns("M1");
+		init_worker(0);
 		switch(protocol) {
 			case 2:	receiver2();	break;
 			case 3:	receiver3();	break;
 			case 4: protocol4();	break;
 			case 5: protocol5();	break;
 			case 6: protocol6();	break;
+			case 7: protocol7();	break;
+			case 8: protocol8();	break;
 		}
 		terminate("Impossible.  Protocol terminated");
 	}
@@ -229,6 +558,8 @@ void fork_off_workers(void)
 	mrfd = r3;	/* fd for reading time from main */
 	mwfd = w4;	/* fd for writing reply to main */
 	prfd = r2;	/* fd for reading frames from worker 1 */
+	if (columns_at != NULL) open_columns("M0");
+	init_worker(0);
 
 	switch(protocol) {
 		case 2:	sender2();	break;
@@ -236,33 +567,56 @@ void fork_off_workers(void)
 		case 4: protocol4();	break;
 		case 5: protocol5();	break;
 		case 6: protocol6();	break;
+		case 7: protocol7();	break;
+		case 8: protocol8();	break;
 	}
 	terminate("Impossible. protocol terminated");
   }
 }
 
+void show_windows(void)
+{
+/* Have each worker show its state, waiting for its reply each time. */
+
+  bigint word;
+
+  write(w3, &(bigint) {DUMP}, TICK_SIZE);
+  read(r4, &word, TICK_SIZE);
+  write(w5, &(bigint) {DUMP}, TICK_SIZE);
+  read(r6, &word, TICK_SIZE);
+}
+
+
 void terminate(char *s)
 {
-/* End the simulation run by sending each worker a 32-bit zero command. */
+/* End the simulation run by sending each worker a zero command. */
 
-  int n, k1, k2, res1[MANY], res2[MANY], eff, acc, sent;
+  int n, k1, k2, eff;
+  bigint res1[MANY], res2[MANY], acc, sent;
 
   for (n = 0; n < MANY; n++) {res1[n] = 0; res2[n] = 0;}
-  write(w3, &zero, TICK_SIZE);
-  write(w5, &zero, TICK_SIZE);
-  sleep(2);
+  if (lockstep) {	/* one at a time, so the output comes out in order */
+	write(w3, &zero, TICK_SIZE);
+	n = read(r4, res1, MANY*sizeof(bigint));
+	write(w5, &zero, TICK_SIZE);
+	n = read(r6, res2, MANY*sizeof(bigint));
+  } else {
+	write(w3, &zero, TICK_SIZE);
+	write(w5, &zero, TICK_SIZE);
+	sleep(2);
 
-  /* Clean out the pipe.  The zero word indicates start of statistics. */
-  n = read(r4, res1, MANY*sizeof(int));
+	/* Clean out the pipes.  The zero word indicates start of statistics. */
+	n = read(r4, res1, MANY*sizeof(bigint));
+	n = read(r6, res2, MANY*sizeof(bigint));
+  }
   k1 = 0;
   while (res1[k1] != 0) k1++;
   k1++;				/* res1[k1] = accepted, res1[k1+1] = sent */
 
-  /* Clean out the other pipe and look for statistics. */
-  n = read(r6, res2, MANY*sizeof(int));
+  /* Look for the statistics in the other pipe's words. */
   k2 = 0;
-  while (res1[k2] != 0) k2++;
-  k2++;				/* res1[k2] = accepted, res1[k2+1] = sent */
+  while (res2[k2] != 0) k2++;
+  k2++;				/* res2[k2] = accepted, res2[k2+1] = sent */
 
   if (strlen(s) > 0) {
 	acc = res1[k1] + res2[k2];
@@ -271,7 +625,7 @@ void terminate(char *s)
 		eff = (100 * acc)/sent;
  	        printf("\nEfficiency (payloads accepted/data pkts sent) = %d%c\n", eff, '%');
 	}
-	printf("%s.  Time=%u\n",s, tick/DELTA);
+	printf("%s.  Time=%lu\n",s, tick/DELTA);
   }
   exit(1);
  }
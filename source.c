@@ -0,0 +1,248 @@
+/* Traffic sources for the network layer.
+ *
+ * Normally the network layer of a worker always has a packet ready, and
+ * the only thing that holds a protocol back is its own window.  A traffic
+ * source instead decides when packets arrive from the network layer above,
+ * so a link can be loaded with less than it can carry.  Each direction has
+ * its own source, chosen on the command line:
+ *
+ *	cbr:N		a packet every N events
+ *	poisson:N	packets arriving at random, on average every N events
+ *	onoff:N:ON:OFF	a packet every N events during on periods, which
+ *			last ON events on average, separated by silent off
+ *			periods of OFF events on average (both exponential)
+ *	trace:FILE	packets arriving at the times, in events, listed in
+ *			FILE, one per line and in increasing order
+ *
+ * Arrival times are made SRC_BLOCK at a time, so all a worker does on an
+ * event is compare the next one with the clock.  Every source draws from
+ * its own random number stream, so the peer can make the very same arrival
+ * times again: since packets are delivered in order, the receiver learns
+ * when each one arrived at the sender by stepping a copy of the sender's
+ * source, and no time stamps have to travel in the frames.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "common.h"
+
+static struct {			/* the source of each direction */
+  int model;			/* SRC_SATURATED, SRC_CBR, ... */
+  double gap, on, off;		/* parameters, in ticks */
+  bigint *trace;		/* the arrival times of a trace, in ticks */
+  long length;			/* how many there are */
+} spec[2];
+
+/* Prototypes. */
+static void refill(struct source *q);
+static double draw(struct source *q, double mean);
+static int load_trace(int dir, char *file);
+
+
+void reset_sources(void)
+{
+/* Make both directions saturated again, as before any run was parsed. */
+
+  int dir;
+
+  for (dir = 0; dir < 2; dir++) {
+	free(spec[dir].trace);
+	memset(&spec[dir], 0, sizeof(spec[dir]));
+  }
+}
+
+
+int parse_source(int dir, char *arg)
+{
+/* Set up the source of direction dir (0 is from M0 to M1) from a command
+ * line argument.  Return 0 if it is good; otherwise complain and return -1.
+ */
+
+  int n = 0;
+
+  if (strncmp(arg, "cbr:", 4) == 0) {
+	spec[dir].model = SRC_CBR;
+	n = sscanf(arg + 4, "%lf", &spec[dir].gap) == 1;
+  } else if (strncmp(arg, "poisson:", 8) == 0) {
+	spec[dir].model = SRC_POISSON;
+	n = sscanf(arg + 8, "%lf", &spec[dir].gap) == 1;
+  } else if (strncmp(arg, "onoff:", 6) == 0) {
+	spec[dir].model = SRC_ONOFF;
+	n = sscanf(arg + 6, "%lf:%lf:%lf", &spec[dir].gap, &spec[dir].on,
+						&spec[dir].off) == 3
+	    && spec[dir].on > 0 && spec[dir].off >= 0;
+  } else if (strncmp(arg, "trace:", 6) == 0) {
+	spec[dir].model = SRC_TRACE;
+	spec[dir].gap = 1;
+	n = load_trace(dir, arg + 6) == 0;
+  }
+  if (n == 0 || spec[dir].gap <= 0) {
+	printf("Bad traffic source %s\n", arg);
+	return(-1);
+  }
+  spec[dir].gap *= DELTA;	/* events to ticks */
+  spec[dir].on *= DELTA;
+  spec[dir].off *= DELTA;
+  sources = 1;
+  return(0);
+}
+
+
+static int load_trace(int dir, char *file)
+{
+/* Read the arrival times of a trace into memory, once for all workers. */
+
+  FILE *fp;
+  char line[100];
+  double t, last = 0;
+  long size = 0;
+
+  if ((fp = fopen(file, "r")) == NULL) {
+	printf("Cannot open %s\n", file);
+	return(-1);
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+	if (line[0] == '#' || sscanf(line, "%lf", &t) != 1) continue;
+	if (t < last) {
+		printf("Times in %s are not in increasing order\n", file);
+		fclose(fp);
+		return(-1);
+	}
+	last = t;
+	if (spec[dir].length == size) {
+		size = (size == 0 ? 1024 : 2 * size);
+		spec[dir].trace = realloc(spec[dir].trace, size * sizeof(bigint));
+		if (spec[dir].trace == NULL) {
+			printf("Out of memory for %s\n", file);
+			fclose(fp);
+			return(-1);
+		}
+	}
+	spec[dir].trace[spec[dir].length++] = (bigint) (t * DELTA);
+  }
+  fclose(fp);
+  return(0);
+}
+
+
+void init_source(struct source *q, int dir, int link)
+{
+/* Start the source of direction dir for a link from the beginning. */
+
+  q->model = spec[dir].model;
+  q->dir = dir;
+  q->rng = stream_seed(link, 3 + dir);
+  q->clock = first_tick;
+  q->on_until = first_tick +
+		(q->model == SRC_ONOFF ? draw(q, spec[dir].on) : 0);
+  q->next = 0;
+  q->n = 0;
+  q->k = 0;
+}
+
+
+int source_ready(struct source *q, bigint now)
+{
+/* Has a packet arrived that has not been taken yet? */
+
+  if (q->model == SRC_SATURATED) return(1);
+  if (q->k == q->n) refill(q);
+  return(q->at[q->k] <= now);
+}
+
+
+bigint source_next(struct source *q)
+{
+/* Take the next packet and return the tick at which it arrived. */
+
+  if (q->model == SRC_SATURATED) return(0);
+  if (q->k == q->n) refill(q);
+  return(q->at[q->k++]);
+}
+
+
+int source_waiting(struct source *q, bigint now)
+{
+/* Count the packets that have arrived but have not been taken yet. */
+
+  int count = 0;
+
+  if (q->model == SRC_SATURATED) return(0);
+  while (source_ready(q, now)) {
+	q->k++;
+	count++;
+  }
+  return(count);
+}
+
+
+int source_pending(struct source *q)
+{
+/* Will more packets arrive?  Only a trace runs out. */
+
+  if (q->model == SRC_SATURATED) return(0);
+  if (q->k == q->n) refill(q);
+  return(q->at[q->k] != NEVER);
+}
+
+
+bigint source_due(struct source *q)
+{
+/* The tick at which the next packet arrives; NEVER if none will. */
+
+  if (q->model == SRC_SATURATED) return(0);
+  if (q->k == q->n) refill(q);
+  return(q->at[q->k]);
+}
+
+
+static void refill(struct source *q)
+{
+/* Make the next SRC_BLOCK arrival times. */
+
+  int i;
+  double gap = spec[q->dir].gap, start;
+
+  for (i = 0; i < SRC_BLOCK; i++) {
+	switch(q->model) {
+	    case SRC_CBR:
+		q->clock += gap;
+		break;
+
+	    case SRC_POISSON:
+		q->clock += draw(q, gap);
+		break;
+
+	    case SRC_ONOFF:
+		if (q->clock + gap <= q->on_until) {
+			q->clock += gap;
+		} else {	/* an off period, then the next on period */
+			start = q->on_until + draw(q, spec[q->dir].off);
+			q->on_until = start + draw(q, spec[q->dir].on);
+			q->clock = start;
+		}
+		break;
+
+	    case SRC_TRACE:
+		q->clock = (q->next < spec[q->dir].length ? first_tick +
+				spec[q->dir].trace[q->next++] : NEVER);
+		break;
+	}
+	q->at[i] = (q->clock < NEVER ? (bigint) q->clock : NEVER);
+  }
+  q->n = SRC_BLOCK;
+  q->k = 0;
+}
+
+
+static double draw(struct source *q, double mean)
+{
+/* An exponentially distributed interval with the given mean. */
+
+  double u;
+
+  u = (next_random(&q->rng) + 0.5) / 2147483648.0;	/* 0 < u < 1 */
+  return(-mean * log(u));
+}
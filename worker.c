@@ -1,24 +1,36 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include "common.h"
 
 #define NR_TIMERS 8		/* number of timers */
 #define MAX_QUEUE 100000	/* max number of buffered frames */
+#define QUEUE_START 64		/* initial size of queue[]; it grows to MAX_QUEUE */
 #define NO_EVENT -1		/* no event possible */
 #define FRAME_SIZE (sizeof(frame))
 #define BYTE 0377		/* byte mask */
-#define UINT_MAX  0xFFFFFFFF	/* maximum value of an unsigned 32-bit int */
+#define FRAME_BITS (8 * (13 + MAX_PKT))	/* on the line, with its CRC */
+#define CH_LOSS   0		/* channel_random() streams, plus the sender */
+#define CH_GARBLE 2
+#define CH_BITS   4
+#define NO_TIMER (~(bigint) 0)	/* lowest_timer when no timer is running */
 #define INTERVAL 100000		/* interval for periodic printing */
 #define AUX 2			/* aux timeout is main timeout/AUX */
+#define RTO_MIN (2 * DELTA)	/* adaptive timeout: lower bound */
+#define RTO_MAX (64 * timeout_interval)	/* adaptive timeout: upper bound */
+#define TIMERS(p) ((p) <= 4 ? 2 : (p) == 5 || (p) == 8 ? 8 : 4)	/* MAX_SEQ+1, NR_BUFS or MAX_CHAN */
 
 /* DEBUG MASKS */
 #define SENDS        0x0001	/* frames sent */
 #define RECEIVES     0x0002	/* frames received */
 #define TIMEOUTS     0x0004	/* timeouts */
 #define PERIODIC     0x0008	/* periodic printout for use with long runs */
+#define EVENTS       0x0010	/* every event picked */
 
 /* Status variables used by the workers, M0 and M1. */
 bigint ack_timer[NR_TIMERS];	/* ack timers */
@@ -26,47 +38,118 @@ unsigned int seqs[NR_TIMERS];	/* last sequence number sent per timer */
 bigint lowest_timer;		/* lowest of the timers */
 bigint aux_timer;		/* value of the auxiliary timer */
 int network_layer_status;	/* 0 is disabled, 1 is enabled */
-unsigned int next_net_pkt;	/* seq of next network packet to fetch */
+bigint next_net_pkt;		/* seq of next network packet to fetch */
 unsigned int last_pkt_given= 0xFFFFFFFF;	/* seq of last pkt delivered*/
 frame last_frame;		/* arrive frames are kept here */
 int offset;			/* to prevent multiple timeouts on same tick*/
 bigint tick;			/* current time */
 int retransmitting;		/* flag that is set on a timeout */
 int nseqs = -1;			/* must be MAX_SEQ + 1 after startup */
+bigint rng;			/* this worker's random number stream */
+bigint sent_at[NR_TIMERS];	/* when the timed frame was sent; 0 if resent */
+long srtt;			/* smoothed round trip time, times 8 */
+long rttvar;			/* round trip time deviation, times 4 */
+bigint rto;			/* adaptive timeout interval, before backoff */
+int repeats;			/* timeouts since the last ack */
+struct source *src;		/* our traffic source, then a copy of the peer's */
+bigint delay_sum;		/* ticks from arrival to delivery, summed */
+unsigned int frames_out;	/* frames put in the peer's pipe */
+unsigned int frames_in;		/* frames taken out of ours */
+bigint clean_bits;		/* intact bits to come before an error (-e) */
+bigint tx_nr;			/* frames put on the line, lost or not (-n) */
+bigint rx_nr;			/* the peer's tx_nr of its next frame (-n) */
+bigint chan_rng;		/* bit errors coming our way (-n) */
+bigint chan_key;		/* the link's channel (-n), same for both */
 extern unsigned int oldest_frame;	/* tells protocol 6 which frame timed out */
+extern boolean no_nak;		/* protocol 6 global; per worker like ours */
 
 char *badgood[] = {"bad ", "good"};
 char *tag[] = {"Data", "Ack ", "Nak "};
+char *event_name[] = {"frame_arrival", "cksum_err", "timeout",
+			"network_layer_ready", "ack_timeout"};
 
 /* Statistics */
-int data_sent;			/* number of data frames sent */
-int data_retransmitted;		/* number of data frames retransmitted */
-int data_lost;			/* number of data frames lost */
-int data_not_lost;		/* number of data frames not lost */
-int good_data_recd;		/* number of data frames received */
-int cksum_data_recd;		/* number of bad data frames received */
-
-int acks_sent;			/* number of ack frames sent */
-int acks_lost;			/* number of ack frames lost */
-int acks_not_lost;		/* number of ack frames not lost */
-int good_acks_recd;		/* number of ack frames received */
-int cksum_acks_recd;		/* number of bad ack frames received */
-
-int payloads_accepted;		/* number of pkts passed to network layer */
-int timeouts;			/* number of timeouts */
-int ack_timeouts;		/* number of ack timeouts */
+bigint data_sent;		/* number of data frames sent */
+bigint data_retransmitted;	/* number of data frames retransmitted */
+bigint data_lost;		/* number of data frames lost */
+bigint data_not_lost;		/* number of data frames not lost */
+bigint good_data_recd;		/* number of data frames received */
+bigint cksum_data_recd;		/* number of bad data frames received */
+
+bigint acks_sent;		/* number of ack frames sent */
+bigint acks_lost;		/* number of ack frames lost */
+bigint acks_not_lost;		/* number of ack frames not lost */
+bigint good_acks_recd;		/* number of ack frames received */
+bigint cksum_acks_recd;		/* number of bad ack frames received */
+bigint naks_sent;		/* number of nak frames sent */
+
+bigint payloads_accepted;	/* number of pkts passed to network layer */
+bigint timeouts;		/* number of timeouts */
+bigint ack_timeouts;		/* number of ack timeouts */
+bigint undetected;		/* damaged frames whose CRC still matched */
+bigint bits_flipped;		/* bit errors of the channel (-e) */
+
+char *stat_label[NSTAT] = {
+  "Total data frames sent:", "Data frames lost:", "Data frames not lost:",
+  "Frames retransmitted:", "Good ack frames rec'd:", "Bad ack frames rec'd:",
+  "Good data frames rec'd:", "Bad data frames rec'd:", "Payloads accepted:",
+  "Total ack frames sent:", "Ack frames lost:", "Ack frames not lost:",
+  "Timeouts:", "Ack timeouts:", "Total nak frames sent:", "Timeout in use:",
+  "Smoothed round trip:", "Packets offered:", "Mean packet delay:",
+  "Undetected errors:", "Bit errors:"
+};
 
 /* Incoming frames are buffered here for later processing. */
-frame queue[MAX_QUEUE];		/* buffered incoming frames */
-frame *inp = &queue[0];		/* where to put the next frame */
-frame *outp = &queue[0];	/* where to remove the next frame from */
+frame *queue;			/* buffered incoming frames (qsize of them) */
+int qsize;			/* frames queue[] has room for */
+frame *inp;			/* where to put the next frame */
+frame *outp;			/* where to remove the next frame from */
 int nframes;			/* number of queued frames */
 
+int this_link;			/* link being simulated, for result files */
+
+/* The per-worker globals.  In the fork engine every worker process has its
+ * own copy of them.  The in-process engine runs all workers in one address
+ * space, so it saves and restores everything on this list whenever it
+ * switches from one worker to another.
+ */
+#define WORKER_STATE \
+	S(ack_timer) S(seqs) S(lowest_timer) S(aux_timer) \
+	S(network_layer_status) S(next_net_pkt) S(last_pkt_given) \
+	S(last_frame) S(offset) S(retransmitting) S(nseqs) S(rng) \
+	S(oldest_frame) S(no_nak) S(id) S(sent_at) S(srtt) S(rttvar) S(rto) \
+	S(repeats) S(src) S(delay_sum) S(frames_out) S(frames_in) \
+	S(data_sent) S(data_retransmitted) S(data_lost) S(data_not_lost) \
+	S(good_data_recd) S(cksum_data_recd) S(acks_sent) S(acks_lost) \
+	S(acks_not_lost) S(good_acks_recd) S(cksum_acks_recd) S(naks_sent) \
+	S(payloads_accepted) S(timeouts) S(ack_timeouts) S(undetected) \
+	S(bits_flipped) S(clean_bits) S(tx_nr) S(rx_nr) S(chan_rng) S(chan_key) \
+	S(queue) S(qsize) S(inp) S(outp) S(nframes)
+
+/* The part of them that decides what a worker can do next, by which
+ * exploration (-v) tells states apart.  The statistics, the random number
+ * streams and the pointers into queue[] are left out; so are the counters
+ * that only grow, such as frames_out and repeats, or no state would ever
+ * be seen twice, and last_frame, which the next frame overwrites before
+ * anything reads it.
+ */
+#define MODEL_STATE \
+	S(ack_timer) S(seqs) S(lowest_timer) S(aux_timer) \
+	S(network_layer_status) S(next_net_pkt) S(last_pkt_given) \
+	S(retransmitting) S(nseqs) S(oldest_frame) S(no_nak) S(id) S(nframes)
+
 /* Prototypes. */
 void wait_for_event(event_type *event);
 void queue_frames(void);
+void grow_queue(int need);
 int pick_event(void);
+int pick_any(int p);
 event_type frametype(void);
+int damage(int hit);
+int channel_errors(unsigned char *got);
+bigint error_gap(void);
+unsigned int channel_random(int who, bigint nr);
+unsigned int channel_next(void);
 void from_network_layer(packet *p);
 void to_network_layer(packet *p);
 void from_physical_layer(frame *r);
@@ -77,13 +160,19 @@ void start_ack_timer(void);
 void stop_ack_timer(void);
 void enable_network_layer(void);
 void disable_network_layer(void);
-int check_timers(void);
+int check_timers(int n);
 int check_ack_timer(void);
 unsigned int pktnum(packet *p);
 void fr(frame *f);
 void recalc_timers(void);
+bigint timeout_in_use(void);
+void rtt_sample(bigint m);
 void print_statistics(void);
 void sim_error(char *s);
+void read_frames(frame *f, int k);
+void worker_exit(int status);
+void close_results(void);
+void share(void);
 
 
 void wait_for_event(event_type *event)
@@ -99,34 +188,63 @@ void wait_for_event(event_type *event)
   if (nseqs < 0) nseqs = oldest_frame;	/* need MAX_SEQ+1 for protocol 6 */
   offset = 0;			/* prevents two timeouts at the same tick */
   retransmitting = 0;		/* counts retransmissions */
+  if (verify) tidy_worker();	/* one form for one state (-v) */
   while (true) {
 	queue_frames();		/* go get any newly arrived frames */
-	if (write(mwfd, &word, TICK_SIZE) != TICK_SIZE) print_statistics();
-	if (read(mrfd, &ct, TICK_SIZE) != TICK_SIZE) print_statistics();
+	if (word == QUIET) word = (nframes > 0 ? OK : QUIET |
+		(bigint) (frames_out & 0x3FFFFFFF) << 2 |
+		(bigint) (frames_in & 0x3FFFFFFF) << 32);
+	if (engine == INPROC_ENGINE) {
+		ct = engine_yield(word, policy == POL_UNIFORM ? 0 : next_due(),
+			(char *) __builtin_frame_address(0) + sizeof(void *));
+	} else {
+		if (write(mwfd, &word, TICK_SIZE) != TICK_SIZE)
+			print_statistics();
+		if (read(mrfd, &ct, TICK_SIZE) != TICK_SIZE)
+			print_statistics();
+	}
 	if (ct == 0) print_statistics();
+	if (ct == DUMP) {	/* main found a deadlock */
+		show_window();
+		word = OK;
+		continue;
+	}
 	tick = ct;		/* update time */
-	if ((debug_flags & PERIODIC) && (tick%INTERVAL == 0))
-		printf("Tick %u. Proc %d. Data sent=%d  Payloads accepted=%d  Timeouts=%d\n", tick/DELTA, id, data_sent, payloads_accepted, timeouts);
+	if (metrics_at != NULL && engine == FORK_ENGINE &&
+					tick % (PUBLISH * DELTA) == 0) share();
+	if ((debug_flags & PERIODIC) && (tick%INTERVAL == 0)) {
+		printf("Tick %lu. Proc %d. Data sent=%lu  Payloads accepted=%lu  Timeouts=%lu", tick/DELTA, id, data_sent, payloads_accepted, timeouts);
+		if (adaptive) printf("  Timeout=%lu", timeout_in_use()/DELTA);
+		printf("\n");
+	}
 
 	/* Now pick event. */
 	*event = pick_event();
 	if (*event == NO_EVENT) {
-		word = (lowest_timer == 0 ? NOTHING : OK);
+		/* Is anything bound to happen here, or must a frame come? */
+		word = QUIET;
+		if (lowest_timer != 0 && lowest_timer != NO_TIMER) word = OK;
+		if (aux_timer != 0) word = OK;
+		if (network_layer_status && source_pending(src)) word = OK;
 		continue;
 	}
 	word = OK;
+	if (debug_flags & EVENTS)
+		printf("Tick %lu. Proc %d event %s\n", tick/DELTA, id,
+							event_name[*event]);
 	if (*event == timeout) {
 		timeouts++;
 		retransmitting = 1;	/* enter retransmission mode */
+		repeats++;		/* the timeout backs off if repeated */
 		if (debug_flags & TIMEOUTS)
-		      printf("Tick %u. Proc %d got timeout for frame %d\n",
+		      printf("Tick %lu. Proc %d got timeout for frame %d\n",
 					       tick/DELTA, id, oldest_frame);
 	}
 
 	if (*event == ack_timeout) {
 		ack_timeouts++;
 		if (debug_flags & TIMEOUTS)
-		      printf("Tick %u. Proc %d got ack timeout\n",
+		      printf("Tick %lu. Proc %d got ack timeout\n",
 					       tick/DELTA, id);
 	}
 	return;
@@ -138,35 +256,41 @@ void queue_frames(void)
 {
 /* See if any frames from the peer have arrived; if so get and queue them.
  * Queue_frames() sucks frames out of the pipe into the circular buffer,
- * queue[]. It first fstats the pipe, to avoid reading from an empty pipe and
- * thus blocking.  If inp is near the top of queue[], a single call here
- * may read a few frames into the top of queue[] and then some more starting
- * at queue[0].  This is done in two read operations.
+ * queue[]. It first asks how many bytes are in the pipe, to avoid reading
+ * from an empty pipe and thus blocking.  (FIONREAD is used for this rather
+ * than fstat(), which reports a size of 0 for pipes on many systems.)  If
+ * inp is near the top of queue[], a single call here may read a few frames
+ * into the top of queue[] and then some more starting at queue[0].  This is
+ * done in two read operations.
  */
 
-  int prfd, frct, k;
+  int prfd, frct, k, nbytes;
   frame *top;
-  struct stat statbuf;
 
-  prfd = (id == 0 ? r2 : r1);	/* which file descriptor is pipe on */
-
-  if (fstat(prfd, &statbuf) < 0) sim_error("Cannot fstat peer pipe");
-  frct = statbuf.st_size/FRAME_SIZE;	/* number of arrived frames */
+  if (engine == INPROC_ENGINE) {
+	frct = engine_pending();	/* frames the peer has sent us */
+  } else {
+	prfd = (id == 0 ? r2 : r1);	/* which file descriptor is pipe on */
+	if (ioctl(prfd, FIONREAD, &nbytes) < 0)
+		sim_error("Cannot inspect peer pipe");
+	frct = nbytes/FRAME_SIZE;	/* number of arrived frames */
+  }
+  frames_in += frct;
 
   if (nframes + frct >= MAX_QUEUE)	/* check for possible queue overflow*/
 	sim_error("Out of queue space. Increase MAX_QUEUE and re-make.");  
+  if (nframes + frct >= qsize) grow_queue(nframes + frct);
 
   /* If frct is 0, the pipe is empty, so don't read from it. */
   if (frct > 0) {
 	/* How many frames can be read consecutively? */
-	top = (outp <= inp ? &queue[MAX_QUEUE] : outp);/* how far can we rd?*/
+	top = (outp <= inp ? &queue[qsize] : outp);/* how far can we rd?*/
 	k = top - inp;	/* number of frames that can be read consecutively */
 	if (k > frct) k = frct;	/* how many frames to read from peer */
-	if (read(prfd, inp, k * FRAME_SIZE) != k * FRAME_SIZE)
-		sim_error("Error reading frames from peer");
+	read_frames(inp, k);
 	frct -= k;		/* residual frames not yet read */
 	inp += k;
-	if (inp == &queue[MAX_QUEUE]) inp = queue;
+	if (inp == &queue[qsize]) inp = queue;
 	nframes += k;
 
 	/* If frct is still > 0, the queue has been filled to the upper
@@ -174,8 +298,7 @@ void queue_frames(void)
 	 * there.  This mechanism makes queue a circular buffer.
 	 */
 	if (frct > 0) {
-		if (read(prfd, queue, frct * FRAME_SIZE) != frct*FRAME_SIZE)
-			sim_error("Error 2 reading frames from peer");
+		read_frames(queue, frct);
 		nframes += frct;
 		inp = &queue[frct];
 	}
@@ -183,6 +306,34 @@ void queue_frames(void)
 }
 
 
+void grow_queue(int need)
+{
+/* Make room in queue[] for more than need frames, up to MAX_QUEUE.  A worker
+ * seldom has more than a window's worth of frames waiting, so queue[] starts
+ * small and doubles when a backlog builds; the frames waiting are unrolled
+ * to the front of the new one.
+ */
+
+  int n, k;
+  frame *grown;
+
+  n = qsize;
+  while (n <= need) n *= 2;
+  if (n > MAX_QUEUE) n = MAX_QUEUE;
+  grown = (frame *) malloc(n * FRAME_SIZE);
+  if (grown == NULL) sim_error("Out of memory for queue");
+  for (k = 0; k < nframes; k++) {
+	grown[k] = *outp++;
+	if (outp == &queue[qsize]) outp = queue;
+  }
+  free(queue);
+  queue = grown;
+  qsize = n;
+  outp = queue;
+  inp = &queue[nframes];
+}
+
+
 int pick_event(void)
 {
 /* Pick a random event that is now possible for the process.
@@ -192,12 +343,12 @@ int pick_event(void)
  * are potentially allowed.  The maximum is given by highest_event.  The
  * events that are theoretically possible are given below.
  *
- *  # Event		Protocols:  1 2 3 4 5 6
- *  0 frame_arrival                 x x x x x x
- *  1 chksum_err                        x x x x
- *  2 timeout                           x x x x
- *  3 network_layer_ready                   x x 
- *  4 ack_timeout                             x (e.g. only 6 gets ack_timeout)
+ *  # Event		Protocols:  1 2 3 4 5 6 7 8
+ *  0 frame_arrival                 x x x x x x x x
+ *  1 chksum_err                        x x x x x x
+ *  2 timeout                           x x x x x x
+ *  3 network_layer_ready                   x x x x
+ *  4 ack_timeout                             x x x (only 6 to 8 get it)
  *
  * Note that the order in which the tests is made is critical, as it gives
  * priority to some events over others.  For example, for protocols 3 and 4
@@ -205,6 +356,7 @@ int pick_event(void)
  * a reasonable strategy, and more closely models how a real line works.
  */
 
+  if (verify) return(pick_any(protocol));	/* any of them, when exploring */
   switch(protocol) {
     case 2:			/* {frame_arrival} */
 	if (nframes == 0 && lowest_timer == 0) return(NO_EVENT);
@@ -213,25 +365,76 @@ int pick_event(void)
     case 3:			/* {frame_arrival, cksum_err, timeout} */
     case 4:
 	if (nframes > 0) return((int)frametype());
-	if (check_timers() >= 0) return(timeout);	/* timer went off */
+	if (check_timers(TIMERS(protocol)) >= 0) return(timeout);	/* timer went off */
 	return(NO_EVENT);
 
     case 5:	/* {frame_arrival, cksum_err, timeout, network_layer_ready} */
 	if (nframes > 0) return((int)frametype());
-	if (network_layer_status) return(network_layer_ready);
-	if (check_timers() >= 0) return(timeout);	/* timer went off */
+	if (network_layer_status && source_ready(src, tick))
+		return(network_layer_ready);
+	if (check_timers(TIMERS(protocol)) >= 0) return(timeout);	/* timer went off */
 	return(NO_EVENT);
 
     case 6:	/* {frame_arrival, cksum_err, timeout, net_rdy, ack_timeout}*/
+    case 7:
+    case 8:
 	if (check_ack_timer() > 0) return(ack_timeout);
 	if (nframes > 0) return((int)frametype());
-	if (network_layer_status) return(network_layer_ready);
-	if (check_timers() >= 0) return(timeout);	/* timer went off */
+	if (network_layer_status && source_ready(src, tick))
+		return(network_layer_ready);
+	if (check_timers(TIMERS(protocol)) >= 0) return(timeout);	/* timer went off */
 	return(NO_EVENT);
   }
 }
 
 
+bigint next_due(void)
+{
+/* The first tick at which pick_event() will find an event, unless a frame
+ * comes first: 0 if there is one now, NEVER if only a frame can wake us.
+ * Main uses it to leave out turns in which we would do nothing (-y).
+ */
+
+  bigint t = NEVER;
+
+  if (nframes > 0) return(0);
+  if (protocol == 2) return(lowest_timer != 0 ? 0 : NEVER);
+  if (protocol >= 5 && network_layer_status) t = source_due(src);
+  if (protocol >= 3 && lowest_timer != 0 && lowest_timer < t) t = lowest_timer;
+  if (protocol >= 6 && aux_timer > 0 && aux_timer < t) t = aux_timer;
+  return(t);
+}
+
+
+int pick_any(int p)
+{
+/* Pick_event() for exploration (-v): list every event that is possible
+ * now, counting every frame the peer has sent, and let the explorer
+ * choose.  Time is not kept, so a timer that is
+ * running may go off at once; tidy_worker() keeps the timers below tick,
+ * in the order they were set, so check_timers() finds the oldest one.
+ * The network layer has no more than verify packets to give.
+ */
+
+  int n = 0, can[4];
+
+  queue_frames();		/* what the peer sent is on its way */
+  if (nframes > 0) can[n++] = frame_arrival;
+  if (p >= 5 && network_layer_status && next_net_pkt < verify)
+	can[n++] = network_layer_ready;
+  if (p >= 3 && lowest_timer != 0 && lowest_timer != NO_TIMER)
+	can[n++] = timeout;
+  if (p >= 6 && aux_timer != 0) can[n++] = ack_timeout;
+  if (n == 0) return(NO_EVENT);
+  switch(can[choose_way(n)]) {
+    case frame_arrival:	return((int) frametype());
+    case network_layer_ready:	return(network_layer_ready);
+    case timeout:	check_timers(NR_TIMERS);	return(timeout);
+    default:	check_ack_timer();	return(ack_timeout);
+  }
+}
+
+
 event_type frametype(void)
 {
 /* This function is called after it has been decided that a frame_arrival
@@ -248,32 +451,53 @@ event_type frametype(void)
  * or bad (contains a checksum error).
  */
 
-  int n, i;
+  int n, i, hit;
+  frame_kind kind;
   event_type event;
 
   /* Remove one frame from the queue. */
   last_frame = *outp;		/* copy the first frame in the queue */
   outp++;
-  if (outp == &queue[MAX_QUEUE]) outp = queue;
+  if (outp == &queue[qsize]) outp = queue;
   nframes--;
 
-  /* Generate frames with checksum errors at random. */
-  n = rand() & 01777;
-  if (n < garbled) {
+  /* Generate frames with checksum errors at random: with a chance of
+   * garbled per frame, or where the channel's bit errors fall (-e).
+   */
+  if (verify) {			/* either way, if it can happen at all */
+	hit = (garbled > 0 && choose_way(2));
+  } else if (ber > 0) {
+	hit = (clean_bits < FRAME_BITS);
+	if (!hit || checksum == NO_CRC) channel_errors((unsigned char *) 0);
+  } else if (common) {		/* skip what the peer sent that was lost */
+	while ((channel_random(CH_LOSS + 1 - id, rx_nr) & 01777) < pkt_loss)
+		rx_nr++;
+	n = channel_random(CH_GARBLE + 1 - id, rx_nr++) & 01777;
+	hit = (n < garbled);
+  } else {
+	n = next_random(&rng) & 01777;
+	hit = (n < garbled);
+  }
+  if (medium != MED_NONE && checksum == NO_CRC && last_frame.cksum != 0)
+	hit = 1;		/* collided on the shared medium (-g) */
+  kind = last_frame.kind;	/* as sent: damage() may flip bits in it */
+  if (checksum != NO_CRC ? damage(hit) : hit) {
 	/* Checksum error.*/
 	event = cksum_err;
-	if (last_frame.kind == data) cksum_data_recd++;
-	if (last_frame.kind == ack) cksum_acks_recd++;
+	if (kind == data) cksum_data_recd++;
+	if (kind == ack) cksum_acks_recd++;
 	i = 0;
   } else {
 	event = frame_arrival;
-	if (last_frame.kind == data) good_data_recd++;
-	if (last_frame.kind == ack) good_acks_recd++;
+	if (kind == data) good_data_recd++;
+	if (kind == ack) good_acks_recd++;
 	i = 1;
   }
+  if (columns_at != NULL)
+	frame_row(tick, this_link, id, i ? COL_GOOD : COL_BAD, &last_frame);
 
   if (debug_flags & RECEIVES) {
-	printf("Tick %u. Proc %d got %s frame:  ",
+	printf("Tick %lu. Proc %d got %s frame:  ",
 						tick/DELTA,id,badgood[i]);
 	fr(&last_frame);
   }
@@ -281,10 +505,102 @@ event_type frametype(void)
 }
 
 
+int damage(int hit)
+{
+/* With real checksums (-k), the channel flips bits in last_frame, CRC
+ * included, if hit: where its bit errors fall (-e), or else one bit, and
+ * then one more as long as a coin comes up heads.  Then the receiver
+ * checks the CRC.  Return 1 if it does not match; a damaged frame with a
+ * matching CRC is let through.
+ */
+
+  int n, b;
+  unsigned char sent[13 + MAX_PKT], got[13 + MAX_PKT];
+
+  if (hit) {
+	n = wire_frame(&last_frame, sent);
+	memcpy(&sent[n], &last_frame.cksum, 4);
+	memcpy(got, sent, n + 4);
+	if (ber > 0) channel_errors(got);
+	else do {
+		b = channel_next() % (8 * (n + 4));
+		got[b/8] ^= 1 << (b%8);
+	} while (channel_next() & 1);
+	unwire_frame(got, &last_frame);
+	memcpy(&last_frame.cksum, &got[n], 4);
+  }
+  if (frame_crc(&last_frame) != last_frame.cksum) return(1);
+  if (hit && memcmp(sent, got, n + 4) != 0) undetected++;
+  return(0);
+}
+
+
+int channel_errors(unsigned char *got)
+{
+/* Pass a frame of FRAME_BITS bits through a channel with bit error rate
+ * ber, flipping the bits hit in got, if not 0.  Only the gaps between
+ * errors are drawn, so the cost goes with the errors, not with the bits;
+ * the gap running past the end of the frame carries over to the next one.
+ * Return the number of bits hit.
+ */
+
+  int k = 0;
+  bigint b;
+
+  for (b = clean_bits; b < FRAME_BITS; b += 1 + error_gap()) {
+	if (got != NULL) got[b/8] ^= 1 << (b%8);
+	k++;
+  }
+  clean_bits = b - FRAME_BITS;
+  bits_flipped += k;
+  return(k);
+}
+
+
+bigint error_gap(void)
+{
+/* Intact bits before the next error: geometric, with parameter ber. */
+
+  double u = (channel_next() + 1.0) / 2147483648.0;	/* (0, 1] */
+
+  return((bigint) floor(log(u) / log1p(-ber)));
+}
+
+
+unsigned int channel_random(int who, bigint nr)
+{
+/* Common random numbers (-n): 31 random bits that depend only on the link,
+ * on who (CH_LOSS or CH_GARBLE, plus the sending worker's id) and on nr,
+ * the sender's transmission number, so the channel treats the nr-th frame
+ * sent in a direction the same way whatever the protocol and whatever
+ * happened before.  The receiver finds the number of an arriving frame by
+ * skipping the frames the same function says were lost.
+ */
+
+  return((unsigned int) (mix(chan_key + 0xD1B54A32D192ED03UL *
+					(8 * nr + who + 1)) >> 33));
+}
+
+
+unsigned int channel_next(void)
+{
+/* The next random number for damage done to frames coming our way: with
+ * -n from a stream of their own, otherwise from the worker's stream.
+ */
+
+  return(next_random(common ? &chan_rng : &rng));
+}
+
+
 void from_network_layer(packet *p)
 {
 /* Fetch a packet from the network layer for transmission on the channel. */
 
+  bigint at;
+
+  at = source_next(&src[0]);	/* it is no longer waiting */
+  if (columns_at != NULL) payload_fetched(this_link, id, next_net_pkt,
+			src[0].model == SRC_SATURATED ? tick : at);
   p->data[0] = (next_net_pkt >> 24) & BYTE;
   p->data[1] = (next_net_pkt >> 16) & BYTE;
   p->data[2] = (next_net_pkt >>  8) & BYTE;
@@ -304,12 +620,17 @@ void to_network_layer(packet *p)
 
   num = pktnum(p);
   if (num != last_pkt_given + 1) {
-	printf("Tick %u. Proc %d got protocol error.  Packet delivered out of order.\n", tick/DELTA, id); 
-	printf("Expected payload %d but got payload %d\n",last_pkt_given+1,num);
-	exit(0);
+	if (!searching) {
+		printf("Tick %lu. Proc %d got protocol error.  Packet delivered out of order.\n", tick/DELTA, id); 
+		printf("Expected payload %u but got payload %u\n",last_pkt_given+1,num);
+	}
+	worker_exit(0);
   }
   last_pkt_given = num;
   payloads_accepted++;
+  if (columns_at != NULL) payload_delivered(id, num, tick);
+  if (src[1].model != SRC_SATURATED)	/* when did the peer get it? */
+	delay_sum += tick - source_next(&src[1]);
 }
 
   
@@ -335,9 +656,11 @@ void to_physical_layer(frame *s)
   switch(protocol) {
     case 2:
 	s->seq = 0;
+	s->ack = 0;
 
     case 3:
 	s->kind = (id == 0 ? data : ack);
+	if (s->kind == data) s->ack = 0;
 	if (s->kind == ack) {
 		s->seq = 0;
 		s->info.data[0] = 0;
@@ -353,7 +676,8 @@ void to_physical_layer(frame *s)
 	break;
 
      case 6:
-	if (s->kind == nak) {
+     case 7:
+	if (s->kind == nak || (protocol == 6 && s->kind == ack)) {
 		s->info.data[0] = 0;
 		s->info.data[1] = 0;
 		s->info.data[2] = 0;
@@ -371,17 +695,39 @@ void to_physical_layer(frame *s)
 	 * the sequence number.
 	 */
 	if (s->kind==data) seqs[s->seq % (nseqs/2)] = s->seq; /* save seq # */
+	break;
+
+     case 8:
+	if (s->kind == ack) {
+		s->info.data[0] = 0;
+		s->info.data[1] = 0;
+		s->info.data[2] = 0;
+		s->info.data[3] = 0;
+	}
+	if (s->kind == data) seqs[s->seq / 2] = s->seq;	/* by channel */
   }
 
+  s->cksum = (checksum != NO_CRC ? frame_crc(s) : 0);
+  s->conn = 0;			/* the only one on its pipe; see mux.c */
   if (s->kind == data) data_sent++;
   if (s->kind == ack) acks_sent++;
+  if (s->kind == nak) naks_sent++;
   if (retransmitting) data_retransmitted++;
 
   /* Bad transmissions (checksum errors) are simulated here. */
-  k = rand() & 01777;		/* 0 <= k <= about 1000 (really 1023) */
+  if (verify)
+	k = (pkt_loss > 0 && choose_way(2) ? 0 : 01777);	/* lost or not (-v) */
+  else if (common)
+	k = channel_random(CH_LOSS + id, tx_nr++) & 01777;
+  else
+	k = next_random(&rng) & 01777;	/* 0 <= k <= about 1000 (really 1023) */
+  if (columns_at != NULL) {
+	frame_row(tick, this_link, id, k < pkt_loss ? COL_LOST : COL_SENT, s);
+	if (s->kind == data) payload_sent(id, pktnum(&s->info), tick);
+  }
   if (k < pkt_loss) {	/* simulate packet loss */
 	if (debug_flags & SENDS) {
-		printf("Tick %u. Proc %d sent frame that got lost: ",
+		printf("Tick %lu. Proc %d sent frame that got lost: ",
 							    tick/DELTA, id);
 		fr(s);
 	}
@@ -392,13 +738,17 @@ void to_physical_layer(frame *s)
   }
   if (s->kind == data) data_not_lost++;		/* statistics gathering */
   if (s->kind == ack) acks_not_lost++;		/* ditto */
-  fd = (id == 0 ? w1 : w2);
-
-  got = write(fd, s, FRAME_SIZE);
-  if (got != FRAME_SIZE) print_statistics();	/* must be done */
+  frames_out++;
+  if (engine == INPROC_ENGINE) {
+	engine_send(s);		/* straight into the peer's pipe */
+  } else {
+	fd = (id == 0 ? w1 : w2);
+	got = write(fd, s, FRAME_SIZE);
+	if (got != FRAME_SIZE) print_statistics();	/* must be done */
+  }
 
   if (debug_flags & SENDS) {
-	printf("Tick %u. Proc %d sent frame: ", tick/DELTA, id);
+	printf("Tick %lu. Proc %d sent frame: ", tick/DELTA, id);
 	fr(s);
   }
 }
@@ -406,9 +756,20 @@ void to_physical_layer(frame *s)
 
 void start_timer(seq_nr k)
 {
-/* Start a timer for a data frame. */
+/* Start a timer for a data frame.  Remember when the frame was sent, so
+ * its ack gives a round trip time sample.  If the frame is being sent
+ * again, it is unknown which copy an ack is for (Karn's rule), and frames
+ * sent after it are held up behind it, so no pending sample is kept.
+ */
+
+  int i;
 
-  ack_timer[k] = tick + timeout_interval + offset;
+  if (retransmitting || ack_timer[k] != 0) {
+	for (i = 0; i < NR_TIMERS; i++) sent_at[i] = 0;
+  } else {
+	sent_at[k] = tick;
+  }
+  ack_timer[k] = tick + timeout_in_use() + offset;
   offset++;
   recalc_timers();		/* figure out which timer is now lowest */
 }
@@ -416,8 +777,11 @@ void start_timer(seq_nr k)
 
 void stop_timer(seq_nr k)
 {
-/* Stop a data frame timer. */
+/* Stop a data frame timer.  The frame has been acknowledged. */
 
+  if (ack_timer[k] != 0 && sent_at[k] != 0) rtt_sample(tick - sent_at[k]);
+  sent_at[k] = 0;
+  repeats = 0;
   ack_timer[k] = 0;
   recalc_timers();		/* figure out which timer is now lowest */
 }
@@ -460,9 +824,11 @@ void disable_network_layer(void)
 }
 
 
-int check_timers(void)
+int check_timers(int n)
 {
-/* Check for possible timeout.  If found, reset the timer. */
+/* Check for possible timeout.  If found, reset the timer.  Only the first
+ * n timers can be running.
+ */
 
   int i;
 
@@ -475,7 +841,7 @@ int check_timers(void)
    * guarantees that each successive timer set gets a higher value than the
    * previous one.
    */
-  for (i = 0; i < NR_TIMERS; i++) {
+  for (i = 0; i < n; i++) {
 	if (ack_timer[i] == lowest_timer) {
 		ack_timer[i] = 0;	/* turn the timer off */
 		recalc_timers();	/* find new lowest timer */
@@ -483,8 +849,8 @@ int check_timers(void)
 		return(i);
 	}
   }
-  printf("Impossible.  check_timers failed at %d\n", lowest_timer);
-  exit(1);
+  printf("Impossible.  check_timers failed at %lu\n", lowest_timer);
+  worker_exit(1);
 }
 
 
@@ -521,7 +887,8 @@ void fr(frame *f)
 /* Print frame information for tracing. */
 
   printf("type=%s  seq=%d  ack=%d  payload=%d\n",
-	tag[f->kind], f->seq, f->ack, pktnum(&f->info));
+	f->kind <= nak ? tag[f->kind] : "????", f->seq, f->ack,
+	pktnum(&f->info));
 }
 
 void recalc_timers(void)
@@ -529,7 +896,7 @@ void recalc_timers(void)
 /* Find the lowest timer */
 
   int i;
-  bigint t = UINT_MAX;
+  bigint t = NO_TIMER;
 
   for (i = 0; i < NR_TIMERS; i++) {
 	if (ack_timer[i] > 0 && ack_timer[i] < t) t = ack_timer[i];
@@ -538,41 +905,303 @@ void recalc_timers(void)
 }
 
 
+bigint timeout_in_use(void)
+{
+/* The timeout interval start_timer() uses: the one given on the command
+ * line or, with -a, the one adapted to the round trip time.  That one is
+ * doubled for every timeout after the first since the last ack, so a frame
+ * that keeps timing out is retried less and less often.
+ */
+
+  bigint t;
+  int i;
+
+  if (!adaptive) return(timeout_interval);
+  t = rto;
+  for (i = 1; i < repeats && t < RTO_MAX; i++) t = 2 * t;
+  return(t < RTO_MAX ? t : RTO_MAX);
+}
+
+
+void rtt_sample(bigint m)
+{
+/* Fold a round trip time of m ticks into the smoothed round trip time and
+ * its mean deviation, the way Jacobson and Karels do it.  Srtt is kept
+ * times 8 and rttvar times 4, so the gains of 1/8 and 1/4 are shifts, and
+ * the timeout becomes srtt + 4*rttvar.
+ */
+
+  long delta;
+
+  if (srtt == 0) {
+	srtt = m << 3;		/* first sample: rttvar is half of it */
+	rttvar = m << 1;
+  } else {
+	delta = (long) m - (srtt >> 3);
+	srtt += delta;
+	if (delta < 0) delta = -delta;
+	rttvar += delta - (rttvar >> 2);
+  }
+  rto = (srtt >> 3) + rttvar;
+  if (rto < RTO_MIN) rto = RTO_MIN;
+  if (rto > RTO_MAX) rto = RTO_MAX;
+}
+
+
 void print_statistics(void)
 {
 /* Display statistics. */
 
-  int word[3];
+  bigint word[3], st[NSTAT];
 
+  if (engine == INPROC_ENGINE) engine_exit(0);	/* engine prints them */
   sleep(1);
-  printf("\nProcess %d:\n", id);
-  printf("\tTotal data frames sent:  %9d\n", data_sent);
-  printf("\tData frames lost:        %9d\n", data_lost);
-  printf("\tData frames not lost:    %9d\n", data_not_lost);
-  printf("\tFrames retransmitted:    %9d\n", data_retransmitted);
-  printf("\tGood ack frames rec'd:   %9d\n", good_acks_recd);
-  printf("\tBad ack frames rec'd:    %9d\n\n", cksum_acks_recd);
-
-  printf("\tGood data frames rec'd:  %9d\n", good_data_recd);
-  printf("\tBad data frames rec'd:   %9d\n", cksum_data_recd);
-  printf("\tPayloads accepted:       %9d\n", payloads_accepted);
-  printf("\tTotal ack frames sent:   %9d\n", acks_sent);
-  printf("\tAck frames lost:         %9d\n", acks_lost);
-  printf("\tAck frames not lost:     %9d\n", acks_not_lost);
-
-  printf("\tTimeouts:                %9d\n", timeouts);
-  printf("\tAck timeouts:            %9d\n", ack_timeouts);
+  collect_statistics(st);
+  show_statistics(id, st);
   fflush(stdin);
 
   word[0] = 0;
   word[1] = payloads_accepted;
   word[2] = data_sent;
-  write(mwfd, word, 3*sizeof(int));	/* tell main we are done printing */
+  write(mwfd, word, 3*sizeof(bigint));	/* tell main we are done printing */
+  close_results();
   sleep(1);
   exit(0);
 }
 
 
+int timeouts_in_a_row(void)
+{
+/* The level function of splitting (-x): timeouts since the last ack. */
+
+  return(repeats);
+}
+
+
+void reseed_worker(bigint salt)
+{
+/* Give a copy of this worker made for splitting (-x) a future of its own.
+ * The traffic sources are left alone: each worker keeps a copy of the
+ * peer's, which must stay in step with it.
+ */
+
+  rng = mix(rng + salt);
+  chan_rng = mix(chan_rng + salt);
+}
+
+
+void tidy_worker(void)
+{
+/* Put the worker's state in one standard form, so that exploration (-v)
+ * sees a state it has seen before as the same.  The timers running are
+ * numbered 1, 2, ... in the order they were set, which keeps them below
+ * tick, and the ack timer is 1 if it runs.  The queued frames are moved to
+ * the front of queue[]; as this is done before every event, and a worker
+ * never has many frames coming when exploring, queue[] never wraps.
+ */
+
+  int i, k;
+  bigint rank[NR_TIMERS];
+
+  for (i = 0; i < NR_TIMERS; i++) {
+	rank[i] = 0;
+	if (ack_timer[i] == 0) continue;
+	for (k = 0; k < NR_TIMERS; k++)
+		if (ack_timer[k] != 0 && (ack_timer[k] < ack_timer[i] ||
+				(ack_timer[k] == ack_timer[i] && k <= i)))
+			rank[i]++;
+  }
+  memcpy(ack_timer, rank, sizeof(ack_timer));
+  recalc_timers();
+  if (aux_timer != 0) aux_timer = 1;
+  memmove(queue, outp, nframes * FRAME_SIZE);
+  outp = queue;
+  inp = &queue[nframes];
+}
+
+
+bigint hash_worker(bigint h)
+{
+/* Add the state of the worker, as MODEL_STATE has it, to hash h. */
+
+#define S(x) h = hash_more(h, (char *) &x, sizeof(x));
+  MODEL_STATE
+#undef S
+  return(hash_more(h, (char *) outp, nframes * FRAME_SIZE));
+}
+
+
+int save_model(char *p)
+{
+/* Copy the globals MODEL_STATE lists, the packets delivered and the queued
+ * frames to p, for exploration; return how many bytes.  The other globals
+ * do not change what a worker does while exploring, so a state is put back
+ * with whatever they hold.
+ */
+
+  char *q = p;
+
+#define S(x) memcpy(q, &x, sizeof(x)); q += sizeof(x);
+  MODEL_STATE
+  S(payloads_accepted)
+#undef S
+  memcpy(q, outp, nframes * FRAME_SIZE);
+  return(q - p + nframes * FRAME_SIZE);
+}
+
+
+int load_model(char *p)
+{
+/* Put back what save_model() copied to p, with queue[] in the form
+ * tidy_worker() leaves it in; return how many bytes.
+ */
+
+  char *q = p;
+
+#define S(x) memcpy(&x, q, sizeof(x)); q += sizeof(x);
+  MODEL_STATE
+  S(payloads_accepted)
+#undef S
+  outp = queue;
+  inp = &queue[nframes];
+  memcpy(outp, q, nframes * FRAME_SIZE);
+  return(q - p + nframes * FRAME_SIZE);
+}
+
+
+int frames_queued(void)
+{
+  return(nframes);
+}
+
+
+bigint packets_delivered(void)
+{
+  return(payloads_accepted);
+}
+
+
+void count_progress(bigint c[3])
+{
+/* Add this worker's share of the counters the stopping rule watches. */
+
+  c[PRG_PAYLOADS] += payloads_accepted;
+  c[PRG_SENT] += data_sent;
+  c[PRG_RETRANS] += data_retransmitted;
+}
+
+
+void collect_statistics(bigint s[])
+{
+/* Copy this worker's statistics into s[], in the order they are printed.
+ * This may be done in mid-run (-m), so nothing may change.
+ */
+
+  struct source q;
+
+  s[0] = data_sent;
+  s[1] = data_lost;
+  s[2] = data_not_lost;
+  s[3] = data_retransmitted;
+  s[4] = good_acks_recd;
+  s[5] = cksum_acks_recd;
+  s[6] = good_data_recd;
+  s[7] = cksum_data_recd;
+  s[8] = payloads_accepted;
+  s[9] = acks_sent;
+  s[10] = acks_lost;
+  s[11] = acks_not_lost;
+  s[12] = timeouts;
+  s[13] = ack_timeouts;
+  s[14] = naks_sent;
+  s[15] = timeout_in_use()/DELTA;
+  s[16] = (srtt >> 3)/DELTA;
+  q = src[0];			/* counting steps the source */
+  s[17] = next_net_pkt + source_waiting(&q, tick);
+  s[18] = (payloads_accepted > 0 ? delay_sum/payloads_accepted/DELTA : 0);
+  s[19] = undetected;
+  s[20] = bits_flipped;
+}
+
+
+void share(void)
+{
+/* Publish this worker's statistics in the fork engine (-m).  Main has a
+ * slot of its own, for the time.
+ */
+
+  bigint st[2][NSTAT];
+
+  memset(st, 0, sizeof(st));
+  collect_statistics(st[id]);
+  publish(id, 0, 0, 0, st);
+}
+
+
+void show_statistics(int proc, bigint s[])
+{
+/* Print a set of statistics gathered by collect_statistics().  The last
+ * line is the control overhead: ack frames (and naks) sent per payload
+ * accepted, the payloads they were sent for.
+ */
+
+  int i;
+
+  printf("\nProcess %d:\n", proc);
+  for (i = 0; i < NSTAT; i++) {
+	if (i == ST_NAKS_SENT && protocol != 6) continue;
+	if ((i == ST_RTO || i == ST_SRTT) && !adaptive) continue;
+	if ((i == ST_OFFERED || i == ST_DELAY) && !sources) continue;
+	if (i == ST_UNDETECTED && checksum == NO_CRC) continue;
+	if (i == ST_BIT_ERRORS && ber == 0) continue;
+	printf("\t%-25s%9lu\n", stat_label[i], s[i]);
+	if (i == 5) printf("\n");	/* sending side above, receiving below */
+  }
+  if (s[ST_PAYLOADS] > 0)
+	printf("\t%-25s%9.2f\n", "Ack frames per payload:",
+		(double) (s[ST_ACKS_SENT] + s[ST_NAKS_SENT])/s[ST_PAYLOADS]);
+}
+
+
+int quiescent(bigint word[2])
+{
+/* Main's deadlock test, given the last reply of each worker.  Both must be
+ * QUIET, and each must have received every frame the other has sent: a
+ * worker's reply is only sent when it runs, so if the peer ran and sent
+ * something since, the counts do not match.
+ */
+
+  return(REPLY(word[0]) == QUIET && REPLY(word[1]) == QUIET &&
+	 SENT(word[0]) == RECEIVED(word[1]) &&
+	 SENT(word[1]) == RECEIVED(word[0]));
+}
+
+
+void show_window(void)
+{
+/* Show what this worker is waiting for, after a deadlock.  The windows
+ * themselves are local to the protocol, but the packets taken from and
+ * given to the network layer, the timers and the frames tell the story.
+ */
+
+  int i, n = 0;
+
+  printf("Proc %d: packets fetched %lu, delivered %lu; network layer %s\n",
+	id, next_net_pkt, payloads_accepted,
+	network_layer_status ? "enabled" : "disabled");
+  printf("\tframes out %u, in %u, queued %d; timers running:",
+	frames_out, frames_in, nframes);
+  for (i = 0; i < NR_TIMERS; i++) {
+	if (ack_timer[i] == 0) continue;
+	printf(" frame %u", protocol >= 6 ? seqs[i] : i);
+	n++;
+  }
+  if (aux_timer != 0) printf(" ack timer");
+  if (n == 0 && aux_timer == 0) printf(" none");
+  printf("\n");
+}
+
+
 void sim_error(char *s)
 {
 /* A simulator error has occurred. */
@@ -580,7 +1209,146 @@ void sim_error(char *s)
   int fd;
 
   printf("%s\n", s);
+  if (engine == INPROC_ENGINE) engine_exit(1);
   fd = (id == 0 ? w4 : w6);
   write(fd, &zero, TICK_SIZE);
+  close_results();
   exit(1);
 }
+
+
+void read_frames(frame *f, int k)
+{
+/* Read k frames that the peer has sent us into f. */
+
+  if (engine == INPROC_ENGINE) {
+	engine_receive(f, k);
+	return;
+  }
+  if (read(prfd, f, k * FRAME_SIZE) != k * FRAME_SIZE)
+	sim_error("Error reading frames from peer");
+}
+
+
+void worker_exit(int status)
+{
+/* The worker gives up: the process exits, or the coroutine is abandoned. */
+
+  if (engine == INPROC_ENGINE) engine_exit(status);
+  close_results();
+  exit(status);
+}
+
+
+void close_results(void)
+{
+/* A forked worker is about to exit: write out its result files (-o). */
+
+  if (columns_at == NULL) return;
+  flush_payloads(id);
+  close_columns();
+}
+
+
+void init_worker(int link)
+{
+/* Called once per worker before its protocol starts running. */
+
+  this_link = link;
+  tick = first_tick;		/* until main's first go-ahead */
+  rng = stream_seed(link, id);
+  chan_key = stream_seed(link, 2);	/* main's seed, hashed otherwise */
+  chan_rng = mix(chan_key + 0xD1B54A32D192ED03UL * (CH_BITS + id + 1));
+  rto = timeout_interval;	/* until there is a round trip time sample */
+  if (ber > 0) clean_bits = error_gap();
+  if (queue == NULL) {	/* exploring (-v) keeps pointers into it: never move it */
+	qsize = (verify ? MAX_QUEUE : QUEUE_START);
+	queue = (frame *) malloc(qsize * FRAME_SIZE);
+  }
+  if (queue == NULL) sim_error("Out of memory for queue");
+  if (src == NULL) src = (struct source *) malloc(2 * sizeof(struct source));
+  if (src == NULL) sim_error("Out of memory for traffic sources");
+  init_source(&src[0], id, link);	/* what we send */
+  init_source(&src[1], 1 - id, link);	/* what the peer sends us */
+  inp = queue;
+  outp = queue;
+}
+
+
+void release_worker(void)
+{
+/* Give back what init_worker() allocated; the in-process engine calls this
+ * when a link is done, since its workers do not exit.
+ */
+
+  if (columns_at != NULL) flush_payloads(id);
+  free(queue);
+  queue = NULL;
+  free(src);
+  src = NULL;
+}
+
+
+unsigned int next_random(bigint *state)
+{
+/* Advance a random number stream and return 31 random bits.  This is a
+ * 64-bit linear congruential generator (Knuth's MMIX constants); the low
+ * bits of an LCG are poor, so only the high ones are handed out.
+ */
+
+  *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+  return((unsigned int) (*state >> 33));
+}
+
+
+bigint stream_seed(int link, int who)
+{
+/* Derive the starting state of one random number stream from the seed.
+ * Every (link, who) pair gets its own stream, where who is 0 or 1 for the
+ * workers, 2 for main and 3 or 4 for the traffic sources of M0 and M1, so a
+ * link behaves the same no matter which process simulates it or what else
+ * runs before it.
+ */
+
+  return(mix(seed + 0x9E3779B97F4A7C15UL * (5 * (bigint) link + who + 1)));
+}
+
+
+bigint mix(bigint z)
+{
+/* The splitmix64 finalizer: scramble the bits of z. */
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+  return(z ^ (z >> 31));
+}
+
+
+int state_size(void)
+{
+/* Number of bytes needed to hold the per-worker globals. */
+
+#define S(x) + (int) sizeof(x)
+  return(0 WORKER_STATE);
+#undef S
+}
+
+
+void save_state(char *p)
+{
+/* Copy the per-worker globals out to p. */
+
+#define S(x) memcpy(p, &x, sizeof(x)); p += sizeof(x);
+  WORKER_STATE
+#undef S
+}
+
+
+void load_state(char *p)
+{
+/* Copy the per-worker globals back in from p. */
+
+#define S(x) memcpy(&x, p, sizeof(x)); p += sizeof(x);
+  WORKER_STATE
+#undef S
+}